@@ -582,7 +582,10 @@ bool __no_inline_not_in_flash_func(pio_usb_ll_transfer_start)(endpoint_t *ep,
 
 bool __no_inline_not_in_flash_func(pio_usb_ll_transfer_continue)(
     endpoint_t *ep, uint16_t xferred_bytes) {
-  ep->app_buf += xferred_bytes;
+  // streamed IN data never lands in app_buf, keep it pointing at the start
+  if (ep->is_tx || !ep->rx_stream) {
+    ep->app_buf += xferred_bytes;
+  }
   ep->actual_len += xferred_bytes;
   ep->data_id ^= 1;
 
@@ -16,9 +16,27 @@ void pio_usb_host_stop(void);
 void pio_usb_host_restart(void);
 uint32_t pio_usb_host_get_frame_number(void);
 
+// SOFs that went out late or not at all, and the longest gap between two frames
+uint32_t pio_usb_host_get_missed_frames(void);
+uint32_t pio_usb_host_get_worst_frame_gap_us(void);
+void pio_usb_host_reset_frame_stats(void);
+
+// when the last frame started and when its transactions were done, end is
+// before start while a frame is in progress
+void pio_usb_host_get_frame_times(uint32_t *start_us, uint32_t *end_us);
+
 // Call this every 1ms when skip_alarm_pool is true.
 void pio_usb_host_frame(void);
 
+// Deliver IN data packets of an endpoint to cb as they arrive instead of
+// copying them into the transfer buffer, so a transfer of any length only
+// needs a buffer of one packet (or none). cb runs in the host frame handler.
+// It stays bound until cleared with cb = NULL or the endpoint is closed.
+typedef void (*pio_usb_rx_stream_cb_t)(uint8_t const *data, uint16_t len, void *arg);
+bool pio_usb_host_endpoint_set_rx_stream(uint8_t root_idx, uint8_t device_address,
+                                         uint8_t ep_address,
+                                         pio_usb_rx_stream_cb_t cb, void *arg);
+
 // Device functions
 usb_device_t *pio_usb_device_init(const pio_usb_configuration_t *c,
                                   const usb_descriptor_buffers_t *buffers);
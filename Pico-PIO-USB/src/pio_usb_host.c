@@ -29,6 +29,12 @@ static repeating_timer_t sof_rt;
 static volatile uint32_t sof_count = 0;
 static bool timer_active;
 
+// frames that came too late, e.g. while this core was held off flash
+static volatile uint32_t missed_frames;
+static volatile uint32_t worst_frame_gap_us;
+static volatile uint32_t last_frame_us;
+static volatile uint32_t last_frame_end_us;
+
 static volatile bool cancel_timer_flag;
 static volatile bool start_timer_flag;
 static __unused uint32_t int_stat;
@@ -258,6 +264,15 @@ void __not_in_flash_func(pio_usb_host_frame)(void) {
     return;
   }
 
+  uint32_t const now_us = get_time_us_32();
+  uint32_t const gap_us = now_us - last_frame_us;
+  if (last_frame_us) {
+    if (gap_us > worst_frame_gap_us) worst_frame_gap_us = gap_us;
+    // more than one and a half frames apart means at least one SOF never went out
+    if (gap_us > 1500) missed_frames += (gap_us + 500) / 1000 - 1;
+  }
+  last_frame_us = now_us;
+
   pio_port_t *pp = PIO_USB_PIO_PORT(0);
 
   // Send SOF
@@ -351,6 +366,7 @@ void __not_in_flash_func(pio_usb_host_frame)(void) {
   }
 
   sof_count++;
+  last_frame_end_us = get_time_us_32();
 
   // SOF counter is 11-bit
   uint16_t const sof_count_11b = sof_count & 0x7ff;
@@ -376,6 +392,24 @@ uint32_t pio_usb_host_get_frame_number(void) {
   return sof_count;
 }
 
+uint32_t pio_usb_host_get_missed_frames(void) {
+  return missed_frames;
+}
+
+uint32_t pio_usb_host_get_worst_frame_gap_us(void) {
+  return worst_frame_gap_us;
+}
+
+void pio_usb_host_get_frame_times(uint32_t *start_us, uint32_t *end_us) {
+  *end_us = last_frame_end_us;
+  *start_us = last_frame_us;
+}
+
+void pio_usb_host_reset_frame_stats(void) {
+  missed_frames = 0;
+  worst_frame_gap_us = 0;
+}
+
 void pio_usb_host_port_reset_start(uint8_t root_idx) {
   root_port_t *root = PIO_USB_ROOT_PORT(root_idx);
 
@@ -410,6 +444,7 @@ void pio_usb_host_close_device(uint8_t root_idx, uint8_t device_address) {
         ep->size) {
       ep->size = 0;
       ep->has_transfer = false;
+      ep->rx_stream = NULL;
     }
   }
 }
@@ -460,6 +495,7 @@ bool pio_usb_host_endpoint_close(uint8_t root_idx, uint8_t device_address,
   }
 
   ep->size = 0; // mark as closed
+  ep->rx_stream = NULL;
   return true;
 }
 
@@ -498,6 +534,19 @@ bool pio_usb_host_endpoint_transfer(uint8_t root_idx, uint8_t device_address,
   return pio_usb_ll_transfer_start(ep, buffer, buflen);
 }
 
+bool pio_usb_host_endpoint_set_rx_stream(uint8_t root_idx, uint8_t device_address,
+                                         uint8_t ep_address,
+                                         pio_usb_rx_stream_cb_t cb, void *arg) {
+  endpoint_t *ep = _find_ep(root_idx, device_address, ep_address);
+  if (!ep) {
+    return false;
+  }
+
+  ep->rx_stream_arg = arg;
+  ep->rx_stream = cb;
+  return true;
+}
+
 bool pio_usb_host_endpoint_abort_transfer(uint8_t root_idx, uint8_t device_address,
                                           uint8_t ep_address) {
   endpoint_t *ep = _find_ep(root_idx, device_address, ep_address);
@@ -548,7 +597,14 @@ static int __no_inline_not_in_flash_func(usb_in_transaction)(pio_port_t *pp,
 
   if (receive_len >= 0) {
     if (receive_pid == expect_pid) {
-      memcpy(ep->app_buf, &pp->usb_rx_buffer[2], receive_len);
+      if (ep->rx_stream) {
+        ep->rx_stream(&pp->usb_rx_buffer[2], receive_len, ep->rx_stream_arg);
+      } else {
+        // never past what the transfer asked for, whatever the device sends
+        uint16_t const room = ep->total_len - ep->actual_len;
+        memcpy(ep->app_buf, &pp->usb_rx_buffer[2],
+               receive_len < room ? receive_len : room);
+      }
       pio_usb_ll_transfer_continue(ep, receive_len);
     } else {
       // DATA0/1 mismatched, 0 for re-try next frame
@@ -80,6 +80,10 @@ typedef struct {
   uint8_t *app_buf;
   uint16_t total_len;
   uint16_t actual_len;
+
+  // host IN: if set, each data packet is handed here instead of copied to app_buf
+  void (*rx_stream)(uint8_t const *data, uint16_t len, void *arg);
+  void *rx_stream_arg;
 } endpoint_t;
 
 typedef enum {
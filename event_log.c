@@ -0,0 +1,282 @@
+#include <string.h>
+
+#include "event_log.h"
+
+// worst case for one event: device switch (3) + long opcode (2) + varint (5)
+#define PUT_MAX 10
+
+#define USAGE_MODIFIER_FIRST 0xE0
+#define USAGE_MODIFIER_LAST  0xE7
+
+static uint16_t put_varint(uint8_t *p, uint32_t v)
+{
+  uint16_t n = 0;
+
+  while (v >= 0x80) {
+    p[n++] = (uint8_t) (v | 0x80);
+    v >>= 7;
+  }
+  p[n++] = (uint8_t) v;
+  return n;
+}
+
+static bool get_varint(event_log_reader_t *r, uint32_t *v)
+{
+  *v = 0;
+
+  for (uint8_t shift = 0; shift < 35; shift += 7) {
+    if (r->p >= r->end) return false;
+    uint8_t b = *r->p++;
+    *v |= (uint32_t) (b & 0x7F) << shift;
+    if (!(b & 0x80)) return true;
+  }
+  return false;
+}
+
+//--------------------------------------------------------------------+
+// Writing
+//--------------------------------------------------------------------+
+
+bool event_log_begin(event_log_writer_t *w, uint8_t *buf, uint16_t cap, uint32_t time_ms,
+                     uint8_t dev_addr, uint8_t instance, uint8_t modifier)
+{
+  if (cap < EVENT_LOG_SYNC_LEN + 5 + 3 + PUT_MAX) return false;
+
+  memset(w, 0, sizeof(*w));
+  w->buf = buf;
+  w->cap = cap;
+  w->last_ms = time_ms;
+  w->dev_addr = dev_addr;
+  w->instance = instance;
+  w->down_at = -1;
+  w->repeat_at = -1;
+
+  buf[0] = EVENT_LOG_SYNC;
+  buf[1] = 'E';
+  buf[2] = 'V';
+  buf[3] = EVENT_LOG_VERSION;
+  w->len = EVENT_LOG_SYNC_LEN;
+  w->len += put_varint(&buf[w->len], time_ms);
+  buf[w->len++] = dev_addr;
+  buf[w->len++] = instance;
+  buf[w->len++] = modifier;
+  return true;
+}
+
+static void put_key(event_log_writer_t *w, bool down, uint8_t usage, uint32_t dt)
+{
+  uint8_t *p = w->buf;
+
+  if (usage >= EVENT_LOG_SHORT_FIRST && usage < EVENT_LOG_SHORT_FIRST + EVENT_LOG_SHORT_COUNT) {
+    p[w->len++] = (uint8_t) ((usage - EVENT_LOG_SHORT_FIRST) + (down ? 0 : EVENT_LOG_OP_KEY_UP_SHORT));
+  } else {
+    p[w->len++] = down ? EVENT_LOG_OP_KEY_DOWN : EVENT_LOG_OP_KEY_UP;
+    p[w->len++] = usage;
+  }
+  w->len += put_varint(&p[w->len], dt);
+}
+
+// a key up right after the key down of the same usage: fold it into a
+// repeat if it is the same pair as the one before
+static void close_pair(event_log_writer_t *w, uint32_t up_dt)
+{
+  bool const same = w->pair_valid && w->pair_usage == w->down_usage &&
+                    w->pair_down_dt == w->down_dt && w->pair_up_dt == up_dt;
+
+  if (!same) {
+    w->pair_valid = true;
+    w->pair_usage = w->down_usage;
+    w->pair_down_dt = w->down_dt;
+    w->pair_up_dt = up_dt;
+    w->repeat_at = -1;
+    return;
+  }
+
+  // drop the pair just written, count it instead
+  w->len = (uint16_t) w->down_at;
+
+  if (w->repeat_at >= 0 && w->repeat_at + 1 == w->down_at && w->buf[w->repeat_at] < 255) {
+    w->buf[w->repeat_at]++;
+  } else {
+    w->buf[w->len++] = EVENT_LOG_OP_REPEAT;
+    w->repeat_at = (int16_t) w->len;
+    w->buf[w->len++] = 1;
+  }
+}
+
+bool event_log_put(event_log_writer_t *w, event_log_event_t const *ev)
+{
+  if (w->len + PUT_MAX > w->cap) return false;
+
+  uint8_t *p = w->buf;
+
+  if (ev->dev_addr != w->dev_addr || ev->instance != w->instance) {
+    p[w->len++] = EVENT_LOG_OP_DEVICE;
+    p[w->len++] = ev->dev_addr;
+    p[w->len++] = ev->instance;
+    w->dev_addr = ev->dev_addr;
+    w->instance = ev->instance;
+    w->pair_valid = false;
+    w->down_at = -1;
+    w->repeat_at = -1;
+  }
+
+  // clamp, times only go backwards if events were reordered
+  uint32_t dt = (int32_t) (ev->time_ms - w->last_ms) > 0 ? ev->time_ms - w->last_ms : 0;
+  w->last_ms += dt;
+
+  uint16_t const start = w->len;
+  int16_t const down_at = w->down_at;
+  w->down_at = -1;
+
+  switch (ev->type) {
+    case EVENT_LOG_KEY_DOWN:
+      // anything between a pair and its repeat breaks the chain, except the
+      // key down that may start the next pair
+      if (down_at >= 0) w->pair_valid = false;
+      put_key(w, true, ev->code, dt);
+      w->down_at = (int16_t) start;
+      w->down_usage = ev->code;
+      w->down_dt = dt;
+      break;
+
+    case EVENT_LOG_KEY_UP:
+      put_key(w, false, ev->code, dt);
+      if (down_at >= 0 && w->down_usage == ev->code) {
+        w->down_at = down_at;
+        close_pair(w, dt);
+        w->down_at = -1;
+      } else {
+        w->pair_valid = false;
+      }
+      break;
+
+    case EVENT_LOG_MOUSE_BUTTONS:
+      p[w->len++] = EVENT_LOG_OP_MOUSE;
+      p[w->len++] = ev->code;
+      w->len += put_varint(&p[w->len], dt);
+      w->pair_valid = false;
+      break;
+
+    default:
+      break;
+  }
+
+  return true;
+}
+
+//--------------------------------------------------------------------+
+// Reading
+//--------------------------------------------------------------------+
+
+bool event_log_reader_init(event_log_reader_t *r, uint8_t const *block, uint16_t len)
+{
+  memset(r, 0, sizeof(*r));
+  r->p = block;
+  r->end = block + len;
+
+  if (len < EVENT_LOG_SYNC_LEN || block[0] != EVENT_LOG_SYNC || block[1] != 'E' || block[2] != 'V' ||
+      block[3] != EVENT_LOG_VERSION) {
+    return false;
+  }
+  r->p += EVENT_LOG_SYNC_LEN;
+
+  if (!get_varint(r, &r->time_ms) || r->end - r->p < 3) {
+    r->p = r->end;
+    return false;
+  }
+  r->dev_addr = *r->p++;
+  r->instance = *r->p++;
+  r->modifier = *r->p++;
+  return true;
+}
+
+static void track_modifier(event_log_reader_t *r, event_log_event_t const *ev)
+{
+  if (ev->code < USAGE_MODIFIER_FIRST || ev->code > USAGE_MODIFIER_LAST) return;
+
+  uint8_t bit = (uint8_t) (1u << (ev->code - USAGE_MODIFIER_FIRST));
+  if (ev->type == EVENT_LOG_KEY_DOWN) {
+    r->modifier |= bit;
+  } else {
+    r->modifier &= (uint8_t) ~bit;
+  }
+}
+
+static bool emit(event_log_reader_t *r, event_log_event_t *ev, uint8_t type, uint8_t code, uint32_t dt)
+{
+  r->time_ms += dt;
+
+  ev->time_ms = r->time_ms;
+  ev->type = type;
+  ev->dev_addr = r->dev_addr;
+  ev->instance = r->instance;
+  ev->code = code;
+
+  if (type != EVENT_LOG_MOUSE_BUTTONS) track_modifier(r, ev);
+  return true;
+}
+
+bool event_log_next(event_log_reader_t *r, event_log_event_t *ev)
+{
+  if (r->repeat_left) {
+    // odd count left: the key up of a pair, even: the next key down
+    bool down = !(r->repeat_left & 1);
+    r->repeat_left--;
+    return emit(r, ev, down ? EVENT_LOG_KEY_DOWN : EVENT_LOG_KEY_UP, r->pair_usage,
+                down ? r->pair_down_dt : r->pair_up_dt);
+  }
+
+  while (r->p < r->end) {
+    uint8_t op = *r->p++;
+    uint8_t type;
+    uint8_t code;
+    uint32_t dt;
+
+    if (op < EVENT_LOG_OP_KEY_DOWN) {
+      type = op < EVENT_LOG_OP_KEY_UP_SHORT ? EVENT_LOG_KEY_DOWN : EVENT_LOG_KEY_UP;
+      code = (uint8_t) ((op & (EVENT_LOG_SHORT_COUNT - 1)) + EVENT_LOG_SHORT_FIRST);
+    } else if (op == EVENT_LOG_OP_KEY_DOWN || op == EVENT_LOG_OP_KEY_UP || op == EVENT_LOG_OP_MOUSE) {
+      if (r->p >= r->end) break;
+      type = op == EVENT_LOG_OP_KEY_DOWN ? EVENT_LOG_KEY_DOWN :
+             op == EVENT_LOG_OP_KEY_UP ? EVENT_LOG_KEY_UP : EVENT_LOG_MOUSE_BUTTONS;
+      code = *r->p++;
+    } else if (op == EVENT_LOG_OP_REPEAT) {
+      if (r->p >= r->end || !r->pair_valid || *r->p == 0) break;
+      // count pairs, the last pair's up was already produced; start with the next down
+      r->repeat_left = (uint16_t) (*r->p++ * 2 - 1);
+      return emit(r, ev, EVENT_LOG_KEY_DOWN, r->pair_usage, r->pair_down_dt);
+    } else if (op == EVENT_LOG_OP_DEVICE) {
+      if (r->end - r->p < 2) break;
+      r->dev_addr = *r->p++;
+      r->instance = *r->p++;
+      r->modifier = 0;
+      r->pair_valid = false;
+      r->last_type = 0;
+      continue;
+    } else {
+      break;
+    }
+
+    if (!get_varint(r, &dt)) break;
+
+    // remember a down + up pair of one usage for a repeat that may follow
+    if (type == EVENT_LOG_KEY_UP && r->last_type == EVENT_LOG_KEY_DOWN && r->last_usage == code) {
+      r->pair_valid = true;
+      r->pair_usage = code;
+      r->pair_down_dt = r->last_dt;
+      r->pair_up_dt = dt;
+    } else if (type != EVENT_LOG_KEY_DOWN) {
+      r->pair_valid = false;
+    }
+    r->last_type = type;
+    r->last_usage = code;
+    r->last_dt = dt;
+
+    return emit(r, ev, type, code, dt);
+  }
+
+  // end of block, or damaged from here on
+  r->p = r->end;
+  return false;
+}
@@ -0,0 +1,123 @@
+#ifndef EVENT_LOG_H_
+#define EVENT_LOG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Binary event log, version 1. Keeps every key press and release, mouse
+// button changes, their timing and the device they came from, at a bit over
+// two bytes per event for ordinary typing. No dependencies beyond stdint, so
+// the decoder half builds as is on a PC.
+//
+// The log is a sequence of blocks, one per journal record (at most 255
+// bytes), each decodable on its own. Multi-byte numbers are unsigned LEB128
+// varints; times are milliseconds since boot of the logger.
+//
+// A block starts with a sync marker:
+//
+//   F5 'E' 'V' <version> <varint time> <dev_addr> <instance> <modifier>
+//
+// giving the absolute time, the device the following events belong to and
+// the modifier byte held at that point. A reader that lost its place (e.g.
+// in a raw flash image) scans for F5 45 56 01 to pick up again.
+//
+// Then opcodes, dt = varint time since the previous event (or the marker):
+//
+//   00-3F  key down, usage 0x04 + op (letters, digits, Enter ... F10), dt
+//   40-7F  key up,   usage 0x04 + (op - 0x40), dt
+//   80     key down, <usage>, dt
+//   81     key up,   <usage>, dt
+//   82     repeat, <count 1-255>: the key down + key up pair right before
+//          happens count more times, with the same usage and the same two dt
+//   83     device, <dev_addr> <instance>: following events come from there
+//   84     mouse buttons, <new button state>, dt
+//
+// Anything else means the block is damaged; the rest of it is skipped.
+
+#define EVENT_LOG_VERSION 1
+
+#define EVENT_LOG_SYNC      0xF5
+#define EVENT_LOG_SYNC_LEN  4       // F5 'E' 'V' version, before the varint
+
+#define EVENT_LOG_OP_KEY_UP_SHORT 0x40
+#define EVENT_LOG_OP_KEY_DOWN     0x80
+#define EVENT_LOG_OP_KEY_UP       0x81
+#define EVENT_LOG_OP_REPEAT       0x82
+#define EVENT_LOG_OP_DEVICE       0x83
+#define EVENT_LOG_OP_MOUSE        0x84
+
+// usages with a one byte opcode
+#define EVENT_LOG_SHORT_FIRST 0x04
+#define EVENT_LOG_SHORT_COUNT 0x40
+
+// event types, the same values as input_event_type_t
+enum {
+  EVENT_LOG_KEY_DOWN = 1,
+  EVENT_LOG_KEY_UP,
+  EVENT_LOG_MOUSE_BUTTONS,
+};
+
+typedef struct {
+  uint32_t time_ms;
+  uint8_t type;
+  uint8_t dev_addr;
+  uint8_t instance;
+  uint8_t code;       // usage, or the button state
+} event_log_event_t;
+
+//--------------------------------------------------------------------+
+// Writing
+//--------------------------------------------------------------------+
+
+typedef struct {
+  uint8_t *buf;
+  uint16_t cap;
+  uint16_t len;
+  uint32_t last_ms;
+  uint8_t dev_addr;
+  uint8_t instance;
+  int16_t down_at;        // offset of a key down that is the last op, -1 if none
+  int16_t repeat_at;      // offset of the count of a repeat that is the last op, -1 if none
+  uint8_t down_usage;
+  bool pair_valid;        // the last ops are a down + up pair (or its repeat)
+  uint8_t pair_usage;
+  uint32_t down_dt;
+  uint32_t pair_down_dt;
+  uint32_t pair_up_dt;
+} event_log_writer_t;
+
+// start a block in buf with its sync marker, false if cap is too small
+bool event_log_begin(event_log_writer_t *w, uint8_t *buf, uint16_t cap, uint32_t time_ms,
+                     uint8_t dev_addr, uint8_t instance, uint8_t modifier);
+
+// add one event, false if it doesn't fit (the block is unchanged then)
+bool event_log_put(event_log_writer_t *w, event_log_event_t const *ev);
+
+//--------------------------------------------------------------------+
+// Reading
+//--------------------------------------------------------------------+
+
+typedef struct {
+  uint8_t const *p;
+  uint8_t const *end;
+  uint32_t time_ms;
+  uint8_t dev_addr;
+  uint8_t instance;
+  uint8_t modifier;       // modifier keys held, kept up to date while reading
+  uint16_t repeat_left;   // events still to produce from a repeat, two per pair
+  bool pair_valid;
+  uint8_t last_type;
+  uint8_t last_usage;
+  uint8_t pair_usage;
+  uint32_t last_dt;
+  uint32_t pair_down_dt;
+  uint32_t pair_up_dt;
+} event_log_reader_t;
+
+// false if the block doesn't start with a sync marker of a known version
+bool event_log_reader_init(event_log_reader_t *r, uint8_t const *block, uint16_t len);
+
+// next event of the block, false at its end or where it is damaged
+bool event_log_next(event_log_reader_t *r, event_log_event_t *ev);
+
+#endif /* EVENT_LOG_H_ */
@@ -0,0 +1,74 @@
+#include <assert.h>
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+#include "event_ring.h"
+
+// Single producer (core1) / single consumer (core0) ring. head is only ever
+// written by core1 and tail only by core0, so no spinlock is needed: each side
+// copies its records first and then publishes the new index behind a barrier.
+// Both indices run freely and are masked on access.
+
+#define EVENT_RING_MASK (EVENT_RING_SIZE - 1)
+
+static_assert((EVENT_RING_SIZE & EVENT_RING_MASK) == 0, "EVENT_RING_SIZE must be a power of two");
+
+static input_event_t ring[EVENT_RING_SIZE];
+static volatile uint32_t head = 0;  // next slot core1 writes
+static volatile uint32_t tail = 0;  // next slot core0 reads
+
+// producer side counters, core0 only reads them
+static volatile uint32_t pushed = 0;
+static volatile uint32_t overflows = 0;
+static volatile uint16_t high_water = 0;
+
+uint32_t event_ring_push(input_event_t const *events, uint32_t count)
+{
+  uint32_t h = head;
+  uint32_t used = h - tail;
+  uint32_t space = EVENT_RING_SIZE - used;
+
+  uint32_t n = count < space ? count : space;
+  if (n < count) overflows += count - n;
+
+  for (uint32_t i = 0; i < n; i++) {
+    ring[(h + i) & EVENT_RING_MASK] = events[i];
+  }
+
+  // records must land before core0 can see the new head
+  __dmb();
+  head = h + n;
+
+  pushed += n;
+  if (used + n > high_water) high_water = (uint16_t) (used + n);
+
+  return n;
+}
+
+uint32_t event_ring_pop(input_event_t *events, uint32_t max)
+{
+  uint32_t t = tail;
+  uint32_t avail = head - t;
+  // don't read records before the head that published them
+  __dmb();
+
+  uint32_t n = avail < max ? avail : max;
+  for (uint32_t i = 0; i < n; i++) {
+    events[i] = ring[(t + i) & EVENT_RING_MASK];
+  }
+
+  // finish copying before core1 may reuse the slots
+  __dmb();
+  tail = t + n;
+
+  return n;
+}
+
+void event_ring_get_stats(event_ring_stats_t *stats)
+{
+  stats->pushed = pushed;
+  stats->overflows = overflows;
+  stats->high_water = high_water;
+  stats->used = (uint16_t) (head - tail);
+}
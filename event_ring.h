@@ -0,0 +1,46 @@
+#ifndef EVENT_RING_H_
+#define EVENT_RING_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// number of records, must be a power of two
+#ifndef EVENT_RING_SIZE
+#define EVENT_RING_SIZE 256
+#endif
+
+typedef enum {
+  EVENT_KEY_DOWN = 1,
+  EVENT_KEY_UP,
+  EVENT_MOUSE_BUTTONS,  // keycode holds the new button state
+} input_event_type_t;
+
+// one fixed-size record per input transition, written by core1 and read by core0
+typedef struct {
+  uint32_t time_us;   // time_us_32() when the report arrived on core1
+  uint8_t dev_addr;
+  uint8_t instance;
+  uint8_t type;       // input_event_type_t
+  uint8_t modifier;   // modifier byte of the report the event came from
+  uint8_t keycode;    // HID usage id
+  uint8_t ascii;      // printable translation, 0 if none
+  uint8_t reserved[2];
+} input_event_t;
+
+typedef struct {
+  uint32_t pushed;      // records accepted since boot
+  uint32_t overflows;   // records dropped because the ring was full
+  uint16_t high_water;  // most records ever waiting at once
+  uint16_t used;        // records waiting right now
+} event_ring_stats_t;
+
+// core1 (producer): publish up to count records in one go, returns how many fit.
+// Never blocks, records that don't fit are counted as overflows.
+uint32_t event_ring_push(input_event_t const *events, uint32_t count);
+
+// core0 (consumer): copy out up to max records, returns how many were taken
+uint32_t event_ring_pop(input_event_t *events, uint32_t max);
+
+void event_ring_get_stats(event_ring_stats_t *stats);
+
+#endif /* EVENT_RING_H_ */
@@ -0,0 +1,48 @@
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "hardware/sync.h"
+
+// With RUN_FROM_RAM the whole image is copied to SRAM at boot, so core1's USB
+// host path (Pico-PIO-USB, TinyUSB host, CRC tables, report processing) never
+// reads flash. Flash writes then don't need to pause core1 the way the SDK's
+// default helper does with multicore_lockout; only core0's own interrupts are
+// held off for the duration. Used by every flash_safe_execute() caller,
+// LittleFS and the journal alike.
+
+#if RUN_FROM_RAM
+
+static uint32_t saved_irq;
+
+static bool ram_core_init_deinit(bool init)
+{
+  (void) init;
+  return true;
+}
+
+static int ram_enter_safe_zone(uint32_t timeout_ms)
+{
+  (void) timeout_ms;
+  saved_irq = save_and_disable_interrupts();
+  return PICO_OK;
+}
+
+static int ram_exit_safe_zone(uint32_t timeout_ms)
+{
+  (void) timeout_ms;
+  restore_interrupts(saved_irq);
+  return PICO_OK;
+}
+
+static flash_safety_helper_t ram_helper = {
+  .core_init_deinit = ram_core_init_deinit,
+  .enter_safe_zone_timeout_ms = ram_enter_safe_zone,
+  .exit_safe_zone_timeout_ms = ram_exit_safe_zone,
+};
+
+// replaces the SDK's weak default
+flash_safety_helper_t *get_flash_safety_helper(void)
+{
+  return &ram_helper;
+}
+
+#endif
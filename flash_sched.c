@@ -0,0 +1,283 @@
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "hardware/flash.h"
+
+#include "lfs.h"
+#include "pio_usb.h"
+#include "flash_sched.h"
+
+// A page program (well under a millisecond) fits the gap between the end of
+// one host frame's transactions and the next SOF, so programs only start when
+// the running estimate of their cost fits both that gap and the per-frame
+// budget. A sector erase (tens of ms) can't fit anywhere; it waits for input
+// to go quiet and then starts right after a frame, to lose as little as
+// possible. Jobs run strictly in queue order.
+
+#define FRAME_US 1000
+#define GUARD_US 50
+#define FLASH_TIMEOUT_MS 100
+
+enum {
+  JOB_PROGRAM = 1,
+  JOB_ERASE,
+};
+
+typedef struct {
+  uint8_t type;
+  uint32_t offset;
+  uint32_t queued_ms;
+  uint32_t queued_us;
+  uint32_t *mark;         // set to mark_value once done
+  uint32_t mark_value;
+  uint8_t data[FLASH_PAGE_SIZE];
+} job_t;
+
+typedef struct {
+  uint32_t offset;
+  uint8_t const *data;
+  uint32_t len;
+} flash_op_t;
+
+static job_t queue[FLASH_SCHED_QUEUE_SIZE];
+static uint16_t q_head = 0;
+static uint16_t q_tail = 0;
+static uint16_t q_count = 0;
+
+static flash_sched_stats_t stats = { .program_est_us = 500 };
+static lat_hist_t program_latency;
+static uint32_t last_input_ms = 0;
+static bool erase_held = false;
+
+// flash time spent in the current host frame
+static uint32_t budget_frame = 0;
+static uint32_t budget_used_us = 0;
+
+static uint32_t window_start_ms = 0;
+static uint32_t window_busy_us = 0;
+
+static uint32_t now_ms(void)
+{
+  return to_ms_since_boot(get_absolute_time());
+}
+
+static void do_program(void *param)
+{
+  flash_op_t const *op = param;
+  flash_range_program(op->offset, op->data, op->len);
+}
+
+static void do_erase(void *param)
+{
+  flash_op_t const *op = param;
+  flash_range_erase(op->offset, op->len);
+}
+
+static int run_op(void (*fn)(void *), flash_op_t *op, uint32_t *elapsed_us)
+{
+  uint32_t start = time_us_32();
+  int rc = flash_safe_execute(fn, op, FLASH_TIMEOUT_MS);
+  *elapsed_us = time_us_32() - start;
+
+  window_busy_us += *elapsed_us;
+
+  if (rc != PICO_OK) {
+    stats.errors++;
+    return LFS_ERR_IO;
+  }
+  return LFS_ERR_OK;
+}
+
+static int run_job(job_t const *job, uint32_t *elapsed_us)
+{
+  int err;
+
+  if (job->type == JOB_ERASE) {
+    flash_op_t op = { job->offset, NULL, FLASH_SECTOR_SIZE };
+    err = run_op(do_erase, &op, elapsed_us);
+    stats.erases++;
+    if (*elapsed_us > stats.worst_erase_us) stats.worst_erase_us = *elapsed_us;
+  } else {
+    flash_op_t op = { job->offset, job->data, FLASH_PAGE_SIZE };
+    err = run_op(do_program, &op, elapsed_us);
+    stats.programs++;
+    if (*elapsed_us > stats.worst_program_us) stats.worst_program_us = *elapsed_us;
+    stats.program_est_us = (3 * stats.program_est_us + *elapsed_us) / 4;
+    lat_hist_add(&program_latency, time_us_32() - job->queued_us);
+  }
+
+  return err;
+}
+
+static int pop_and_run(void)
+{
+  uint32_t elapsed_us;
+  job_t const *job = &queue[q_tail];
+  int err = run_job(job, &elapsed_us);
+
+  // a failed program counts as done too, readers find it by its CRC
+  if (job->mark) *job->mark = job->mark_value;
+
+  budget_used_us += elapsed_us;
+  q_tail = (uint16_t) ((q_tail + 1) % FLASH_SCHED_QUEUE_SIZE);
+  q_count--;
+  erase_held = false;
+  return err;
+}
+
+static job_t *push(uint8_t type, uint32_t offset)
+{
+  // no room: make some the slow way. A failure there belongs to the older
+  // job and is counted in stats.errors, the new one still goes in
+  if (q_count == FLASH_SCHED_QUEUE_SIZE) {
+    stats.forced++;
+    pop_and_run();
+  }
+
+  job_t *job = &queue[q_head];
+  job->type = type;
+  job->offset = offset;
+  job->queued_ms = now_ms();
+  job->queued_us = time_us_32();
+  job->mark = NULL;
+
+  q_head = (uint16_t) ((q_head + 1) % FLASH_SCHED_QUEUE_SIZE);
+  q_count++;
+  if (q_count > stats.queue_high_water) stats.queue_high_water = q_count;
+  return job;
+}
+
+int flash_sched_program(uint32_t offset, uint8_t const *page)
+{
+  return flash_sched_program_mark(offset, page, NULL, 0);
+}
+
+int flash_sched_program_mark(uint32_t offset, uint8_t const *page, uint32_t *mark, uint32_t value)
+{
+  job_t *job = push(JOB_PROGRAM, offset);
+  memcpy(job->data, page, FLASH_PAGE_SIZE);
+  job->mark = mark;
+  job->mark_value = value;
+  return LFS_ERR_OK;
+}
+
+int flash_sched_erase(uint32_t offset)
+{
+  push(JOB_ERASE, offset);
+  return LFS_ERR_OK;
+}
+
+int flash_sched_erase_now(uint32_t offset, uint32_t len)
+{
+  int err = flash_sched_flush();
+  if (err != LFS_ERR_OK) return err;
+
+  uint32_t elapsed_us;
+  flash_op_t op = { offset, NULL, len };
+  err = run_op(do_erase, &op, &elapsed_us);
+  stats.erases += len / FLASH_SECTOR_SIZE;
+  return err;
+}
+
+// time left before the next SOF once this frame's transactions are done, 0 if
+// they are still running or the SOF is too close
+static uint32_t idle_window_us(void)
+{
+  uint32_t start_us, end_us;
+  pio_usb_host_get_frame_times(&start_us, &end_us);
+
+  uint32_t since = time_us_32() - start_us;
+
+  // no frames running (nothing plugged in), no window to respect
+  if (since >= 2 * FRAME_US) return FRAME_US;
+
+  if ((int32_t) (end_us - start_us) < 0) return 0;
+  if (since >= FRAME_US - GUARD_US) return 0;
+  return FRAME_US - GUARD_US - since;
+}
+
+// may the job at the front run now, without being forced
+static bool job_fits(job_t const *job, uint32_t now)
+{
+  uint32_t window = idle_window_us();
+
+  if (job->type == JOB_ERASE) {
+    if (now - last_input_ms < FLASH_SCHED_ERASE_QUIET_MS) {
+      if (!erase_held) {
+        erase_held = true;
+        stats.erases_deferred++;
+      }
+      return false;
+    }
+    return window > 0;
+  }
+
+  uint32_t frame = pio_usb_host_get_frame_number();
+  if (frame != budget_frame) {
+    budget_frame = frame;
+    budget_used_us = 0;
+  }
+
+  return budget_used_us + stats.program_est_us <= FLASH_SCHED_FRAME_BUDGET_US &&
+         stats.program_est_us <= window;
+}
+
+void flash_sched_task(void)
+{
+  uint32_t now = now_ms();
+
+  if (now - window_start_ms >= 1000) {
+    stats.busy_us_per_sec = window_busy_us;
+    window_busy_us = 0;
+    window_start_ms = now;
+  }
+
+  while (q_count) {
+    job_t const *job = &queue[q_tail];
+
+    if (!job_fits(job, now)) {
+      if (now - job->queued_ms < FLASH_SCHED_MAX_DEFER_MS) return;
+      stats.forced++;
+    }
+
+    pop_and_run();
+  }
+}
+
+int flash_sched_flush(void)
+{
+  int err = LFS_ERR_OK;
+
+  while (q_count) {
+    int job_err = pop_and_run();
+    if (err == LFS_ERR_OK) err = job_err;
+  }
+  return err;
+}
+
+void flash_sched_note_input(void)
+{
+  last_input_ms = now_ms();
+}
+
+uint32_t flash_sched_quiet_ms(void)
+{
+  return now_ms() - last_input_ms;
+}
+
+void flash_sched_get_stats(flash_sched_stats_t *out)
+{
+  *out = stats;
+  out->queued = q_count;
+}
+
+lat_hist_t const *flash_sched_program_latency(void)
+{
+  return &program_latency;
+}
+
+void flash_sched_program_latency_reset(void)
+{
+  lat_hist_reset(&program_latency);
+}
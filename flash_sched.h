@@ -0,0 +1,82 @@
+#ifndef FLASH_SCHED_H_
+#define FLASH_SCHED_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "latency.h"
+
+// Owns the journal's page programs and sector erases. They are queued and
+// run from the core0 loop one unit (a page or a sector) at a time, in the
+// idle part of a USB host frame, after its transactions are done.
+
+// jobs waiting, each keeps a copy of its page
+#ifndef FLASH_SCHED_QUEUE_SIZE
+#define FLASH_SCHED_QUEUE_SIZE 8
+#endif
+
+// flash time allowed in one host frame
+#ifndef FLASH_SCHED_FRAME_BUDGET_US
+#define FLASH_SCHED_FRAME_BUDGET_US 500
+#endif
+
+// erases wait until input has been quiet this long
+#ifndef FLASH_SCHED_ERASE_QUIET_MS
+#define FLASH_SCHED_ERASE_QUIET_MS 250
+#endif
+
+// a job that has waited this long runs anyway
+#ifndef FLASH_SCHED_MAX_DEFER_MS
+#define FLASH_SCHED_MAX_DEFER_MS 2000
+#endif
+
+typedef struct {
+  uint32_t busy_us_per_sec;   // flash busy time during the last full second
+  uint32_t programs;
+  uint32_t erases;
+  uint32_t worst_program_us;
+  uint32_t worst_erase_us;
+  uint32_t program_est_us;    // running estimate used to fit programs into frames
+  uint32_t erases_deferred;   // erases held back by input activity
+  uint32_t forced;            // jobs run outside a window: overdue or queue full
+  uint32_t errors;
+  uint16_t queued;
+  uint16_t queue_high_water;
+} flash_sched_stats_t;
+
+// Queueing always succeeds and returns LFS_ERR_OK: with the queue full the
+// oldest job runs first to make room, and if that fails it only shows in
+// stats.errors, the job being queued is not affected.
+
+// queue a program of one FLASH_PAGE_SIZE page, the data is copied
+int flash_sched_program(uint32_t offset, uint8_t const *page);
+
+// the same, and once the page is in flash (and everything queued before it,
+// jobs run in order) *mark is set to value
+int flash_sched_program_mark(uint32_t offset, uint8_t const *page, uint32_t *mark, uint32_t value);
+
+// queue an erase of one sector
+int flash_sched_erase(uint32_t offset);
+
+// erase right away, for setup and formatting
+int flash_sched_erase_now(uint32_t offset, uint32_t len);
+
+// run whatever fits the current window, call from the core0 loop
+void flash_sched_task(void);
+
+// run everything queued now, returns the first LittleFS error code
+int flash_sched_flush(void);
+
+// input arrived, hold erases back for a while
+void flash_sched_note_input(void);
+
+// how long since input last arrived
+uint32_t flash_sched_quiet_ms(void);
+
+void flash_sched_get_stats(flash_sched_stats_t *stats);
+
+// time from queueing a page until it is in flash
+lat_hist_t const *flash_sched_program_latency(void);
+void flash_sched_program_latency_reset(void);
+
+#endif /* FLASH_SCHED_H_ */
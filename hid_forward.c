@@ -0,0 +1,552 @@
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/sync.h"
+
+#include "hid_forward.h"
+#include "log_live.h"
+#include "log_proto.h"
+#include "usb_descriptors.h"
+
+// Reports decoded on core1 are handed to core0 here, so only core0 ever calls
+// into the TinyUSB device stack. Keyboard and mouse reports each go through a
+// single-producer/single-consumer FIFO with barriers, the same way as
+// event_ring. On core0 keyboard reports are sent one by one, in order, while
+// mouse reports are summed into an accumulator for as long as the endpoint is
+// busy, so motion is merged rather than lost. A button change is never merged
+// over, the accumulated motion is sent first. Consumer control and gamepad
+// reports take a third FIFO of raw reports, sent as they are. Each class is
+// relayed on its own device HID instance (see usb_descriptors.h) so keys never
+// queue behind motion.
+//
+// Every host interface shows up as the one device mouse, so the buttons sent
+// are those held on any of them; core0 keeps what each holds down.
+
+#define KBD_QUEUE_MASK   (HID_FORWARD_KBD_QUEUE_SIZE - 1)
+#define MOUSE_QUEUE_MASK (HID_FORWARD_MOUSE_QUEUE_SIZE - 1)
+#define CTRL_QUEUE_MASK  (HID_FORWARD_CTRL_QUEUE_SIZE - 1)
+#define NOTICE_MASK      (HID_FORWARD_NOTICE_SIZE - 1)
+
+static_assert((HID_FORWARD_KBD_QUEUE_SIZE & KBD_QUEUE_MASK) == 0, "HID_FORWARD_KBD_QUEUE_SIZE must be a power of two");
+static_assert((HID_FORWARD_MOUSE_QUEUE_SIZE & MOUSE_QUEUE_MASK) == 0, "HID_FORWARD_MOUSE_QUEUE_SIZE must be a power of two");
+static_assert((HID_FORWARD_CTRL_QUEUE_SIZE & CTRL_QUEUE_MASK) == 0, "HID_FORWARD_CTRL_QUEUE_SIZE must be a power of two");
+static_assert((HID_FORWARD_NOTICE_SIZE & NOTICE_MASK) == 0, "HID_FORWARD_NOTICE_SIZE must be a power of two");
+
+typedef struct {
+  uint32_t time_us;
+  uint8_t dev_addr;
+  uint8_t instance;
+  uint8_t modifier;
+  uint8_t keycode[6];
+} fwd_kbd_report_t;
+
+typedef struct {
+  uint32_t time_us;
+  uint8_t dev_addr;
+  uint8_t instance;
+  hid_mouse_report_t report;
+} fwd_mouse_report_t;
+
+// a report body after its report ID, exactly as it goes to the host
+typedef struct {
+  uint32_t time_us;
+  uint8_t report_id;
+  uint8_t len;
+  uint8_t data[sizeof(hid_gamepad_report_t)];
+} fwd_ctrl_report_t;
+
+// core0: motion summed up while the endpoint was busy
+typedef struct {
+  bool pending;
+  uint8_t buttons;    // of all interfaces together
+  int32_t x, y, wheel, pan;
+  uint32_t time_us;   // of the oldest report merged in
+} mouse_acc_t;
+
+static fwd_kbd_report_t kbd_queue[HID_FORWARD_KBD_QUEUE_SIZE];
+static volatile uint32_t kbd_head = 0;
+static volatile uint32_t kbd_tail = 0;
+
+static fwd_mouse_report_t mouse_queue[HID_FORWARD_MOUSE_QUEUE_SIZE];
+static volatile uint32_t mouse_head = 0;
+static volatile uint32_t mouse_tail = 0;
+
+static mouse_acc_t mouse_acc;
+
+// core0: buttons an interface holds down, free once it holds none
+typedef struct {
+  uint8_t dev_addr;   // 0 = free
+  uint8_t instance;
+  uint8_t buttons;
+} mouse_source_t;
+
+static mouse_source_t mouse_sources[HID_FORWARD_SOURCES];
+
+static fwd_ctrl_report_t ctrl_queue[HID_FORWARD_CTRL_QUEUE_SIZE];
+static volatile uint32_t ctrl_head = 0;
+static volatile uint32_t ctrl_tail = 0;
+
+// core1: the channels each host interface has sent reports on, and the last
+// control state it queued, to skip devices that repeat themselves
+enum {
+  SENT_KEYBOARD = 1 << 0,
+  SENT_MOUSE    = 1 << 1,
+  SENT_CONSUMER = 1 << 2,
+  SENT_GAMEPAD  = 1 << 3,
+};
+
+typedef struct {
+  uint8_t dev_addr;   // 0 = free
+  uint8_t instance;
+  uint8_t sent;
+  uint16_t last_consumer;
+  hid_gamepad_report_t last_gamepad;
+} fwd_source_t;
+
+static fwd_source_t sources[HID_FORWARD_SOURCES];
+
+static char notice_buf[HID_FORWARD_NOTICE_SIZE];
+static volatile uint32_t notice_head = 0;
+static volatile uint32_t notice_tail = 0;
+
+static hid_forward_stats_t stats;
+
+// core0: the report currently sitting in each device HID instance's IN endpoint
+typedef struct {
+  bool busy;
+  uint8_t channel;
+  uint32_t time_us;
+} inflight_t;
+
+static inflight_t inflight[CFG_TUD_HID];
+static lat_hist_t latency[FWD_CHANNEL_COUNT];
+
+//--------------------------------------------------------------------+
+// core1 side
+//--------------------------------------------------------------------+
+
+static fwd_source_t *find_source(uint8_t dev_addr, uint8_t instance, bool create)
+{
+  fwd_source_t *free_source = NULL;
+
+  for (uint8_t i = 0; i < HID_FORWARD_SOURCES; i++) {
+    fwd_source_t *s = &sources[i];
+    if (s->dev_addr == dev_addr && s->instance == instance) return s;
+    if (!free_source && s->dev_addr == 0) free_source = s;
+  }
+
+  if (!create || !free_source) return NULL;
+
+  free_source->dev_addr = dev_addr;
+  free_source->instance = instance;
+  free_source->sent = 0;
+  free_source->last_consumer = 0;
+  memset(&free_source->last_gamepad, 0, sizeof(free_source->last_gamepad));
+  return free_source;
+}
+
+static void note_sent(uint8_t dev_addr, uint8_t instance, uint8_t channel)
+{
+  fwd_source_t *s = find_source(dev_addr, instance, true);
+  if (s) s->sent |= channel;
+}
+
+bool hid_forward_keyboard(uint8_t dev_addr, uint8_t instance, hid_keyboard_report_t const *report, uint32_t time_us)
+{
+  uint32_t h = kbd_head;
+  uint32_t used = h - kbd_tail;
+
+  if (used >= HID_FORWARD_KBD_QUEUE_SIZE) {
+    stats.kbd_dropped++;
+    return false;
+  }
+
+  fwd_kbd_report_t *r = &kbd_queue[h & KBD_QUEUE_MASK];
+  r->time_us = time_us;
+  r->dev_addr = dev_addr;
+  r->instance = instance;
+  r->modifier = report->modifier;
+  memcpy(r->keycode, report->keycode, sizeof(r->keycode));
+
+  __dmb();
+  kbd_head = h + 1;
+
+  note_sent(dev_addr, instance, SENT_KEYBOARD);
+  if (used + 1 > stats.kbd_high_water) stats.kbd_high_water = (uint16_t) (used + 1);
+  return true;
+}
+
+bool hid_forward_mouse(uint8_t dev_addr, uint8_t instance, hid_mouse_report_t const *report, uint32_t time_us)
+{
+  uint32_t h = mouse_head;
+  uint32_t used = h - mouse_tail;
+
+  if (used >= HID_FORWARD_MOUSE_QUEUE_SIZE) {
+    stats.mouse_dropped++;
+    return false;
+  }
+
+  fwd_mouse_report_t *r = &mouse_queue[h & MOUSE_QUEUE_MASK];
+  r->time_us = time_us;
+  r->dev_addr = dev_addr;
+  r->instance = instance;
+  r->report = *report;
+
+  __dmb();
+  mouse_head = h + 1;
+
+  note_sent(dev_addr, instance, SENT_MOUSE);
+  if (used + 1 > stats.mouse_high_water) stats.mouse_high_water = (uint16_t) (used + 1);
+  return true;
+}
+
+static bool ctrl_push(uint8_t report_id, void const *data, uint8_t len, uint32_t time_us)
+{
+  uint32_t h = ctrl_head;
+
+  if (h - ctrl_tail >= HID_FORWARD_CTRL_QUEUE_SIZE) {
+    stats.ctrl_dropped++;
+    return false;
+  }
+
+  fwd_ctrl_report_t *r = &ctrl_queue[h & CTRL_QUEUE_MASK];
+  r->time_us = time_us;
+  r->report_id = report_id;
+  r->len = len;
+  memcpy(r->data, data, len);
+
+  __dmb();
+  ctrl_head = h + 1;
+  return true;
+}
+
+bool hid_forward_consumer(uint8_t dev_addr, uint8_t instance, uint16_t usage, uint32_t time_us)
+{
+  fwd_source_t *s = find_source(dev_addr, instance, true);
+
+  if (s && usage == s->last_consumer) return true;
+  if (!ctrl_push(REPORT_ID_CONSUMER_CONTROL, &usage, sizeof(usage), time_us)) return false;
+
+  if (s) {
+    s->sent |= SENT_CONSUMER;
+    s->last_consumer = usage;
+  }
+  return true;
+}
+
+bool hid_forward_gamepad(uint8_t dev_addr, uint8_t instance, hid_gamepad_report_t const *report, uint32_t time_us)
+{
+  fwd_source_t *s = find_source(dev_addr, instance, true);
+
+  if (s && memcmp(report, &s->last_gamepad, sizeof(*report)) == 0) return true;
+  if (!ctrl_push(REPORT_ID_GAMEPAD, report, sizeof(*report), time_us)) return false;
+
+  if (s) {
+    s->sent |= SENT_GAMEPAD;
+    s->last_gamepad = *report;
+  }
+  return true;
+}
+
+void hid_forward_release(uint8_t dev_addr, uint8_t instance)
+{
+  fwd_source_t *s = find_source(dev_addr, instance, false);
+  if (!s) return;
+
+  uint8_t const sent = s->sent;
+  uint32_t const now = time_us_32();
+
+  // an all-zero report releases the keys and buttons this interface had down,
+  // core0 keeps the mouse buttons of the others
+  if (sent & SENT_KEYBOARD) {
+    hid_keyboard_report_t const empty = { 0 };
+    hid_forward_keyboard(dev_addr, instance, &empty, now);
+  }
+  if (sent & SENT_MOUSE) {
+    hid_mouse_report_t const idle = { 0 };
+    hid_forward_mouse(dev_addr, instance, &idle, now);
+  }
+  if (sent & SENT_CONSUMER) hid_forward_consumer(dev_addr, instance, 0, now);
+  if (sent & SENT_GAMEPAD) {
+    hid_gamepad_report_t const centered = { 0 };
+    hid_forward_gamepad(dev_addr, instance, &centered, now);
+  }
+
+  s->dev_addr = 0;
+}
+
+void hid_forward_notice(const char *fmt, ...)
+{
+  char line[96];
+  va_list args;
+  va_start(args, fmt);
+  int len = vsnprintf(line, sizeof(line), fmt, args);
+  va_end(args);
+
+  if (len <= 0) return;
+  if (len >= (int) sizeof(line)) len = sizeof(line) - 1;
+
+  uint32_t h = notice_head;
+  if (HID_FORWARD_NOTICE_SIZE - (h - notice_tail) < (uint32_t) len) {
+    stats.notices_dropped++;
+    return;
+  }
+
+  for (int i = 0; i < len; i++) {
+    notice_buf[(h + i) & NOTICE_MASK] = line[i];
+  }
+
+  __dmb();
+  notice_head = h + len;
+}
+
+//--------------------------------------------------------------------+
+// core0 side
+//--------------------------------------------------------------------+
+
+static bool send_keyboard(void)
+{
+  uint32_t t = kbd_tail;
+  if (t == kbd_head) return false;
+  __dmb();
+
+  fwd_kbd_report_t const *r = &kbd_queue[t & KBD_QUEUE_MASK];
+  if (!tud_hid_n_keyboard_report(HID_ITF_KEYBOARD, HID_REPORT_ID_KEYBOARD, r->modifier, r->keycode)) {
+    // endpoint refused it, keep it at the front and retry next loop
+    return false;
+  }
+
+  inflight[HID_ITF_KEYBOARD].busy = true;
+  inflight[HID_ITF_KEYBOARD].channel = FWD_CHANNEL_KEYBOARD;
+  inflight[HID_ITF_KEYBOARD].time_us = r->time_us;
+
+  __dmb();
+  kbd_tail = t + 1;
+  stats.kbd_forwarded++;
+  return true;
+}
+
+static bool send_ctrl(void)
+{
+  uint32_t t = ctrl_tail;
+  if (t == ctrl_head) return false;
+  __dmb();
+
+  fwd_ctrl_report_t const *r = &ctrl_queue[t & CTRL_QUEUE_MASK];
+  if (!tud_hid_n_report(HID_ITF_MOUSE, r->report_id, r->data, r->len)) return false;
+
+  inflight[HID_ITF_MOUSE].busy = true;
+  inflight[HID_ITF_MOUSE].channel = FWD_CHANNEL_CONTROL;
+  inflight[HID_ITF_MOUSE].time_us = r->time_us;
+
+  __dmb();
+  ctrl_tail = t + 1;
+  stats.ctrl_forwarded++;
+  return true;
+}
+
+static int8_t take_int8(int32_t *v)
+{
+  int32_t d = TU_MAX(-127, TU_MIN(127, *v));
+  *v -= d;
+  return (int8_t) d;
+}
+
+// buttons the host should see once r is in: its own and those other
+// interfaces hold down; *source is where r's go, NULL if there's no room
+static uint8_t mouse_buttons_with(fwd_mouse_report_t const *r, mouse_source_t **source)
+{
+  mouse_source_t *free_source = NULL;
+  uint8_t buttons = r->report.buttons;
+
+  *source = NULL;
+  for (uint8_t i = 0; i < HID_FORWARD_SOURCES; i++) {
+    mouse_source_t *s = &mouse_sources[i];
+    if (s->dev_addr == r->dev_addr && s->instance == r->instance) {
+      *source = s;
+    } else if (s->dev_addr) {
+      buttons |= s->buttons;
+    } else if (!free_source) {
+      free_source = s;
+    }
+  }
+
+  if (!*source) *source = free_source;
+  return buttons;
+}
+
+// merge queued mouse reports into the accumulator, stopping at a button change
+static void mouse_collect(void)
+{
+  uint32_t t = mouse_tail;
+  uint32_t h = mouse_head;
+  if (t == h) return;
+  __dmb();
+
+  while (t != h) {
+    fwd_mouse_report_t const *r = &mouse_queue[t & MOUSE_QUEUE_MASK];
+    mouse_source_t *source;
+    uint8_t const buttons = mouse_buttons_with(r, &source);
+
+    if (mouse_acc.pending) {
+      if (buttons != mouse_acc.buttons) break;
+      stats.mouse_coalesced++;
+    } else {
+      mouse_acc.pending = true;
+      mouse_acc.buttons = buttons;
+      mouse_acc.time_us = r->time_us;
+    }
+
+    if (source) {
+      source->dev_addr = r->report.buttons ? r->dev_addr : 0;
+      source->instance = r->instance;
+      source->buttons = r->report.buttons;
+    }
+
+    mouse_acc.x += r->report.x;
+    mouse_acc.y += r->report.y;
+    mouse_acc.wheel += r->report.wheel;
+    mouse_acc.pan += r->report.pan;
+    t++;
+  }
+
+  __dmb();
+  mouse_tail = t;
+}
+
+static bool send_mouse(void)
+{
+  mouse_collect();
+  if (!mouse_acc.pending) return false;
+
+  // more than one report's worth of motion goes out over several reports
+  mouse_acc_t const prev = mouse_acc;
+  int8_t x = take_int8(&mouse_acc.x);
+  int8_t y = take_int8(&mouse_acc.y);
+  int8_t wheel = take_int8(&mouse_acc.wheel);
+  int8_t pan = take_int8(&mouse_acc.pan);
+
+  if (!tud_hid_n_mouse_report(HID_ITF_MOUSE, REPORT_ID_MOUSE, mouse_acc.buttons, x, y, wheel, pan)) {
+    mouse_acc = prev;
+    return false;
+  }
+
+  inflight[HID_ITF_MOUSE].busy = true;
+  inflight[HID_ITF_MOUSE].channel = FWD_CHANNEL_MOUSE;
+  inflight[HID_ITF_MOUSE].time_us = mouse_acc.time_us;
+
+  stats.mouse_forwarded++;
+  mouse_acc.pending = mouse_acc.x || mouse_acc.y || mouse_acc.wheel || mouse_acc.pan;
+  return true;
+}
+
+// one report per free endpoint; keys, then media keys and gamepad, then motion
+static void relay_next(uint8_t instance)
+{
+  if (!tud_hid_n_ready(instance)) return;
+  if (instance == HID_ITF_KEYBOARD && send_keyboard()) return;
+  if (instance == HID_ITF_MOUSE && !send_ctrl()) send_mouse();
+}
+
+static void drain_notices(void)
+{
+  uint32_t t = notice_tail;
+  uint32_t avail = notice_head - t;
+  if (!avail) return;
+  __dmb();
+
+  // nobody listening, don't let old text pile up
+  if (!tud_cdc_connected()) {
+    notice_tail = t + avail;
+    return;
+  }
+
+  // text in the middle of binary frames or tail packets would break them,
+  // keep it for later
+  if (log_proto_active() || log_live_active()) return;
+
+  uint32_t start = t & NOTICE_MASK;
+  uint32_t chunk = TU_MIN(avail, HID_FORWARD_NOTICE_SIZE - start);
+  uint32_t written = tud_cdc_write(&notice_buf[start], chunk);
+
+  __dmb();
+  notice_tail = t + written;
+}
+
+void hid_forward_task(void)
+{
+  drain_notices();
+
+  if (!tud_mounted()) {
+    // nothing to forward to, don't replay stale input once the host shows up
+    while (kbd_tail != kbd_head) {
+      kbd_tail = kbd_tail + 1;
+      stats.kbd_discarded++;
+    }
+    while (mouse_tail != mouse_head) {
+      mouse_tail = mouse_tail + 1;
+      stats.mouse_discarded++;
+    }
+    while (ctrl_tail != ctrl_head) {
+      ctrl_tail = ctrl_tail + 1;
+      stats.ctrl_discarded++;
+    }
+    memset(&mouse_acc, 0, sizeof(mouse_acc));
+    memset(mouse_sources, 0, sizeof(mouse_sources));
+    return;
+  }
+
+  // keep merging motion even while a report is in flight, so the queue stays short
+  mouse_collect();
+
+  // normally the completion callback keeps the relay going, this only restarts an idle endpoint
+  for (uint8_t i = 0; i < CFG_TUD_HID; i++) {
+    relay_next(i);
+  }
+}
+
+bool hid_forward_busy(void)
+{
+  if (kbd_tail != kbd_head || mouse_tail != mouse_head || ctrl_tail != ctrl_head) return true;
+
+  for (uint8_t i = 0; i < CFG_TUD_HID; i++) {
+    if (inflight[i].busy) return true;
+  }
+  return false;
+}
+
+void hid_forward_report_complete(uint8_t instance, uint8_t const *report, uint16_t len)
+{
+  (void) report;
+  (void) len;
+
+  if (instance >= CFG_TUD_HID) return;
+
+  inflight_t *f = &inflight[instance];
+  if (f->busy) {
+    f->busy = false;
+    lat_hist_add(&latency[f->channel], time_us_32() - f->time_us);
+  }
+
+  relay_next(instance);
+}
+
+void hid_forward_get_stats(hid_forward_stats_t *out)
+{
+  *out = stats;
+}
+
+lat_hist_t const *hid_forward_latency(fwd_channel_t channel)
+{
+  return &latency[channel];
+}
+
+void hid_forward_latency_reset(void)
+{
+  for (uint8_t i = 0; i < FWD_CHANNEL_COUNT; i++) {
+    lat_hist_reset(&latency[i]);
+  }
+}
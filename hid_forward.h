@@ -0,0 +1,102 @@
+#ifndef HID_FORWARD_H_
+#define HID_FORWARD_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tusb.h"
+#include "latency.h"
+
+// keyboard reports waiting for the device endpoint, must be a power of two
+#ifndef HID_FORWARD_KBD_QUEUE_SIZE
+#define HID_FORWARD_KBD_QUEUE_SIZE 32
+#endif
+
+// mouse reports waiting to be merged into the device accumulator, must be a power of two
+#ifndef HID_FORWARD_MOUSE_QUEUE_SIZE
+#define HID_FORWARD_MOUSE_QUEUE_SIZE 64
+#endif
+
+// consumer control and gamepad reports waiting for the device endpoint, must be a power of two
+#ifndef HID_FORWARD_CTRL_QUEUE_SIZE
+#define HID_FORWARD_CTRL_QUEUE_SIZE 16
+#endif
+
+// host HID interfaces tracked at once, for what each one holds down
+#ifndef HID_FORWARD_SOURCES
+#define HID_FORWARD_SOURCES CFG_TUH_HID
+#endif
+
+// bytes of status text core1 can leave for core0 to print
+#ifndef HID_FORWARD_NOTICE_SIZE
+#define HID_FORWARD_NOTICE_SIZE 256
+#endif
+
+// report streams that get their own pass-through latency histogram
+typedef enum {
+  FWD_CHANNEL_KEYBOARD = 0,
+  FWD_CHANNEL_MOUSE,
+  FWD_CHANNEL_CONTROL,  // consumer control and gamepad
+  FWD_CHANNEL_COUNT
+} fwd_channel_t;
+
+typedef struct {
+  uint32_t kbd_forwarded;
+  uint32_t kbd_dropped;       // queue full on core1
+  uint32_t kbd_discarded;     // thrown away on core0 while no host was mounted
+  uint32_t mouse_forwarded;
+  uint32_t mouse_coalesced;   // reports merged into one already waiting for the endpoint
+  uint32_t mouse_dropped;     // queue full on core1, the motion is lost
+  uint32_t mouse_discarded;   // thrown away on core0 while no host was mounted
+  uint32_t ctrl_forwarded;
+  uint32_t ctrl_dropped;
+  uint32_t ctrl_discarded;
+  uint32_t notices_dropped;
+  uint16_t kbd_high_water;
+  uint16_t mouse_high_water;
+} hid_forward_stats_t;
+
+//--------------------------------------------------------------------+
+// core1 side, never blocks and never touches the device stack
+//--------------------------------------------------------------------+
+
+// queue a keyboard report, keyboard transitions are delivered strictly in order
+bool hid_forward_keyboard(uint8_t dev_addr, uint8_t instance, hid_keyboard_report_t const *report, uint32_t time_us);
+
+// queue a mouse report, core0 sums the motion of everything that piles up while the endpoint is busy
+bool hid_forward_mouse(uint8_t dev_addr, uint8_t instance, hid_mouse_report_t const *report, uint32_t time_us);
+
+// queue a media key change, usage 0 = released; repeats of the interface's last state are skipped
+bool hid_forward_consumer(uint8_t dev_addr, uint8_t instance, uint16_t usage, uint32_t time_us);
+
+// queue a gamepad state, repeats of the interface's last state are skipped
+bool hid_forward_gamepad(uint8_t dev_addr, uint8_t instance, hid_gamepad_report_t const *report, uint32_t time_us);
+
+// an interface went away, let go of the keys and buttons it was holding, on
+// the channels (keyboard, mouse, consumer control, gamepad) it sent reports on
+void hid_forward_release(uint8_t dev_addr, uint8_t instance);
+
+// format a status line for core0 to print on CDC, dropped if there's no room
+void hid_forward_notice(const char *fmt, ...);
+
+//--------------------------------------------------------------------+
+// core0 side
+//--------------------------------------------------------------------+
+
+// call from the core0 loop after tud_task(), starts the relay when the endpoint is idle
+void hid_forward_task(void);
+
+// true while reports are queued or in flight, i.e. someone is typing or moving the mouse
+bool hid_forward_busy(void);
+
+// call from tud_hid_report_complete_cb(), closes the latency sample of the report in flight
+// and submits the next one right away so the endpoint doesn't sit idle until the next loop
+void hid_forward_report_complete(uint8_t instance, uint8_t const *report, uint16_t len);
+
+void hid_forward_get_stats(hid_forward_stats_t *stats);
+
+// time from tuh_hid_report_received_cb() on core1 until the host took the report
+lat_hist_t const *hid_forward_latency(fwd_channel_t channel);
+void hid_forward_latency_reset(void);
+
+#endif /* HID_FORWARD_H_ */
@@ -0,0 +1,691 @@
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#include "hid_report_map.h"
+
+// Report descriptors are walked once, when the interface mounts, and reduced
+// to a short list of input fields (where in the report, how wide, what it
+// means). hid_map_extract() then only runs that list against each report, so
+// NKRO bitmaps, report-ID-prefixed and other non-boot layouts cost about the
+// same to decode as a boot report.
+
+//--------------------------------------------------------------------+
+// Descriptor items
+//--------------------------------------------------------------------+
+
+#define ITEM_TYPE_MAIN   0
+#define ITEM_TYPE_GLOBAL 1
+#define ITEM_TYPE_LOCAL  2
+
+#define MAIN_INPUT          0x8
+#define MAIN_OUTPUT         0x9
+#define MAIN_COLLECTION     0xA
+#define MAIN_FEATURE        0xB
+#define MAIN_END_COLLECTION 0xC
+
+#define GLOBAL_USAGE_PAGE   0x0
+#define GLOBAL_LOGICAL_MIN  0x1
+#define GLOBAL_LOGICAL_MAX  0x2
+#define GLOBAL_REPORT_SIZE  0x7
+#define GLOBAL_REPORT_ID    0x8
+#define GLOBAL_REPORT_COUNT 0x9
+#define GLOBAL_PUSH         0xA
+#define GLOBAL_POP          0xB
+
+#define LOCAL_USAGE         0x0
+#define LOCAL_USAGE_MIN     0x1
+#define LOCAL_USAGE_MAX     0x2
+
+#define INPUT_CONSTANT      0x01
+#define INPUT_VARIABLE      0x02
+
+#define COLLECTION_APPLICATION 0x01
+
+#define USAGE_DESKTOP_POINTER  0x01
+#define USAGE_DESKTOP_MOUSE    0x02
+#define USAGE_DESKTOP_JOYSTICK 0x04
+#define USAGE_DESKTOP_GAMEPAD  0x05
+#define USAGE_DESKTOP_X        0x30
+#define USAGE_DESKTOP_Y        0x31
+#define USAGE_DESKTOP_Z        0x32
+#define USAGE_DESKTOP_RX       0x33
+#define USAGE_DESKTOP_RY       0x34
+#define USAGE_DESKTOP_RZ       0x35
+#define USAGE_DESKTOP_WHEEL    0x38
+#define USAGE_DESKTOP_HAT      0x39
+#define USAGE_CONSUMER_CONTROL 0x01
+#define USAGE_CONSUMER_AC_PAN  0x238
+
+#define DESKTOP(u)  (((uint32_t) HID_USAGE_PAGE_DESKTOP << 16) | (u))
+#define CONSUMER(u) (((uint32_t) HID_USAGE_PAGE_CONSUMER << 16) | (u))
+
+#define MAX_LOCAL_USAGES 8
+#define MAX_REPORT_IDS   8
+#define GLOBAL_STACK     2
+
+typedef struct {
+  uint16_t usage_page;
+  int32_t logical_min;
+  int32_t logical_max;
+  uint8_t report_size;
+  uint8_t report_count;
+  uint8_t report_id;
+} global_state_t;
+
+typedef struct {
+  global_state_t global;
+  global_state_t stack[GLOBAL_STACK];
+  uint8_t stack_depth;
+
+  // local items, cleared after every main item
+  uint32_t usages[MAX_LOCAL_USAGES];   // page << 16 | usage
+  uint8_t n_usages;
+  uint32_t usage_min;
+  uint32_t usage_max;
+  bool has_min;
+  bool has_max;
+
+  uint32_t app_usage;                  // usage of the enclosing application collection
+  uint8_t depth;
+
+  // running input bit offset of each report ID
+  uint8_t offset_ids[MAX_REPORT_IDS];
+  uint16_t offset_bits[MAX_REPORT_IDS];
+  uint8_t n_offsets;
+
+  hid_report_map_t *map;
+} parser_t;
+
+static hid_report_map_t maps[HID_MAP_SLOTS];
+
+static uint16_t *report_offset(parser_t *p, uint8_t report_id)
+{
+  for (uint8_t i = 0; i < p->n_offsets; i++) {
+    if (p->offset_ids[i] == report_id) return &p->offset_bits[i];
+  }
+  if (p->n_offsets == MAX_REPORT_IDS) return NULL;
+
+  p->offset_ids[p->n_offsets] = report_id;
+  p->offset_bits[p->n_offsets] = 0;
+  return &p->offset_bits[p->n_offsets++];
+}
+
+// add a usage from a local item, 1-2 byte usages take the current usage page
+static uint32_t full_usage(parser_t const *p, uint32_t data, uint8_t size)
+{
+  return size == 4 ? data : ((uint32_t) p->global.usage_page << 16) | (data & 0xffff);
+}
+
+// usage of element n of the current main item
+static uint32_t element_usage(parser_t const *p, uint8_t n)
+{
+  if (p->has_min) return p->usage_min + n;
+  if (p->n_usages == 0) return 0;
+  return p->usages[n < p->n_usages ? n : p->n_usages - 1];
+}
+
+static void add_field(parser_t *p, uint8_t kind, uint16_t bit_offset, uint8_t count, uint16_t usage_min)
+{
+  hid_report_map_t *map = p->map;
+  if (map->n_fields == HID_MAP_MAX_FIELDS) return;
+
+  hid_field_t *f = &map->fields[map->n_fields++];
+  f->bit_offset = bit_offset;
+  f->bit_size = p->global.report_size;
+  f->count = count;
+  f->report_id = p->global.report_id;
+  f->kind = kind;
+  f->is_signed = p->global.logical_min < 0;
+  f->reserved = 0;
+  f->usage_min = usage_min;
+  f->logical_min = p->global.logical_min;
+  f->logical_max = p->global.logical_max;
+
+  map->kinds |= (uint16_t) (1u << kind);
+}
+
+static bool is_pointer_app(uint32_t app_usage)
+{
+  return app_usage == DESKTOP(USAGE_DESKTOP_MOUSE) || app_usage == DESKTOP(USAGE_DESKTOP_POINTER);
+}
+
+static bool is_gamepad_app(uint32_t app_usage)
+{
+  return app_usage == DESKTOP(USAGE_DESKTOP_JOYSTICK) || app_usage == DESKTOP(USAGE_DESKTOP_GAMEPAD);
+}
+
+static void consumer_item(parser_t *p, uint16_t start, bool variable)
+{
+  global_state_t const *g = &p->global;
+
+  if (!variable) {
+    add_field(p, HID_FIELD_CONSUMER_ARRAY, start, g->report_count, p->has_min ? (uint16_t) p->usage_min : 0);
+  } else if (g->report_size == 1 && p->has_min) {
+    add_field(p, HID_FIELD_CONSUMER_BITMAP, start, g->report_count, (uint16_t) p->usage_min);
+  } else if (g->report_size == 1) {
+    // media key bitmaps usually list one usage per bit
+    for (uint8_t n = 0; n < g->report_count && n < p->n_usages; n++) {
+      add_field(p, HID_FIELD_CONSUMER_FLAG, (uint16_t) (start + n), 1, (uint16_t) p->usages[n]);
+    }
+  }
+}
+
+static void gamepad_item(parser_t *p, uint16_t start, bool variable)
+{
+  global_state_t const *g = &p->global;
+  if (!variable) return;
+
+  if (g->usage_page == HID_USAGE_PAGE_BUTTON) {
+    if (g->report_size == 1) add_field(p, HID_FIELD_GAMEPAD_BUTTONS, start, g->report_count, (uint16_t) element_usage(p, 0));
+    return;
+  }
+
+  for (uint8_t n = 0; n < g->report_count; n++) {
+    uint32_t usage = element_usage(p, n);
+    uint16_t bit = (uint16_t) (start + n * g->report_size);
+
+    if (usage >= DESKTOP(USAGE_DESKTOP_X) && usage <= DESKTOP(USAGE_DESKTOP_RZ)) {
+      add_field(p, HID_FIELD_GAMEPAD_AXIS, bit, 1, (uint16_t) usage);
+    } else if (usage == DESKTOP(USAGE_DESKTOP_HAT)) {
+      add_field(p, HID_FIELD_GAMEPAD_HAT, bit, 1, (uint16_t) usage);
+    }
+  }
+}
+
+static void input_item(parser_t *p, uint32_t flags)
+{
+  global_state_t const *g = &p->global;
+
+  uint16_t *offset = report_offset(p, g->report_id);
+  if (!offset) return;
+
+  uint16_t const start = *offset;
+  *offset += (uint16_t) (g->report_size * g->report_count);
+
+  if ((flags & INPUT_CONSTANT) || g->report_size == 0 || g->report_size > 32) return;
+
+  bool const variable = flags & INPUT_VARIABLE;
+  uint16_t const first = (uint16_t) (element_usage(p, 0) & 0xffff);
+
+  if (p->app_usage == CONSUMER(USAGE_CONSUMER_CONTROL)) {
+    if (g->usage_page == HID_USAGE_PAGE_CONSUMER) consumer_item(p, start, variable);
+    return;
+  }
+
+  if (is_gamepad_app(p->app_usage)) {
+    gamepad_item(p, start, variable);
+    return;
+  }
+
+  switch (g->usage_page) {
+    case HID_USAGE_PAGE_KEYBOARD:
+      if (!variable) {
+        add_field(p, HID_FIELD_KEY_ARRAY, start, g->report_count, p->has_min ? first : 0);
+      } else if (g->report_size == 1) {
+        add_field(p, HID_FIELD_KEY_BITMAP, start, g->report_count, first);
+      }
+      break;
+
+    case HID_USAGE_PAGE_BUTTON:
+      if (variable && g->report_size == 1 && is_pointer_app(p->app_usage)) {
+        add_field(p, HID_FIELD_BUTTONS, start, g->report_count, first);
+      }
+      break;
+
+    default:
+      if (!variable || !is_pointer_app(p->app_usage)) break;
+
+      // axes are listed one usage per element
+      for (uint8_t n = 0; n < g->report_count; n++) {
+        uint32_t usage = element_usage(p, n);
+        uint16_t bit = (uint16_t) (start + n * g->report_size);
+        uint8_t kind = 0;
+
+        if      (usage == DESKTOP(USAGE_DESKTOP_X))        kind = HID_FIELD_MOUSE_X;
+        else if (usage == DESKTOP(USAGE_DESKTOP_Y))        kind = HID_FIELD_MOUSE_Y;
+        else if (usage == DESKTOP(USAGE_DESKTOP_WHEEL))    kind = HID_FIELD_WHEEL;
+        else if (usage == CONSUMER(USAGE_CONSUMER_AC_PAN)) kind = HID_FIELD_PAN;
+
+        if (kind) add_field(p, kind, bit, 1, (uint16_t) usage);
+      }
+      break;
+  }
+}
+
+static void clear_locals(parser_t *p)
+{
+  p->n_usages = 0;
+  p->has_min = false;
+  p->has_max = false;
+}
+
+static void parse_item(parser_t *p, uint8_t type, uint8_t tag, uint32_t data, uint8_t size)
+{
+  // sign-extended copy for logical minimum
+  int32_t sdata = size == 1 ? (int8_t) data : size == 2 ? (int16_t) data : (int32_t) data;
+
+  switch (type) {
+    case ITEM_TYPE_MAIN:
+      switch (tag) {
+        case MAIN_INPUT:
+          input_item(p, data);
+          break;
+
+        case MAIN_COLLECTION:
+          if (p->depth == 0 && data == COLLECTION_APPLICATION) {
+            p->app_usage = element_usage(p, 0);
+          }
+          p->depth++;
+          break;
+
+        case MAIN_END_COLLECTION:
+          if (p->depth) p->depth--;
+          if (p->depth == 0) p->app_usage = 0;
+          break;
+
+        default: break;
+      }
+      clear_locals(p);
+      break;
+
+    case ITEM_TYPE_GLOBAL:
+      switch (tag) {
+        case GLOBAL_USAGE_PAGE:   p->global.usage_page = (uint16_t) data; break;
+        case GLOBAL_LOGICAL_MIN:  p->global.logical_min = sdata; break;
+
+        case GLOBAL_LOGICAL_MAX:
+          // a maximum like 255 in one byte only reads right unsigned
+          p->global.logical_max = (sdata < p->global.logical_min) ? (int32_t) data : sdata;
+          break;
+        case GLOBAL_REPORT_SIZE:  p->global.report_size = (uint8_t) data; break;
+        case GLOBAL_REPORT_COUNT: p->global.report_count = (uint8_t) data; break;
+
+        case GLOBAL_REPORT_ID:
+          p->global.report_id = (uint8_t) data;
+          p->map->has_report_id = true;
+          break;
+
+        case GLOBAL_PUSH:
+          if (p->stack_depth < GLOBAL_STACK) p->stack[p->stack_depth++] = p->global;
+          break;
+
+        case GLOBAL_POP:
+          if (p->stack_depth) p->global = p->stack[--p->stack_depth];
+          break;
+
+        default: break;
+      }
+      break;
+
+    case ITEM_TYPE_LOCAL:
+      switch (tag) {
+        case LOCAL_USAGE:
+          if (p->n_usages < MAX_LOCAL_USAGES) p->usages[p->n_usages++] = full_usage(p, data, size);
+          break;
+
+        case LOCAL_USAGE_MIN:
+          p->usage_min = full_usage(p, data, size);
+          p->has_min = true;
+          break;
+
+        case LOCAL_USAGE_MAX:
+          p->usage_max = full_usage(p, data, size);
+          p->has_max = true;
+          break;
+
+        default: break;
+      }
+      break;
+
+    default: break;
+  }
+}
+
+//--------------------------------------------------------------------+
+// Map slots
+//--------------------------------------------------------------------+
+
+hid_report_map_t const *hid_map_find(uint8_t dev_addr, uint8_t instance)
+{
+  for (uint8_t i = 0; i < HID_MAP_SLOTS; i++) {
+    if (maps[i].dev_addr == dev_addr && maps[i].instance == instance) return &maps[i];
+  }
+  return NULL;
+}
+
+void hid_map_release(uint8_t dev_addr, uint8_t instance)
+{
+  for (uint8_t i = 0; i < HID_MAP_SLOTS; i++) {
+    if (maps[i].dev_addr == dev_addr && maps[i].instance == instance) maps[i].dev_addr = 0;
+  }
+}
+
+//--------------------------------------------------------------------+
+// Streaming parser
+//--------------------------------------------------------------------+
+
+// Item framing is kept in the parser, so a descriptor can be fed in pieces of
+// any size (down to single bytes) with items split across the pieces.
+
+typedef struct {
+  parser_t p;
+  bool active;
+  uint8_t dev_addr;
+  uint8_t instance;
+
+  uint8_t prefix;       // prefix of the item being collected, 0 = expecting a prefix
+  uint8_t need;         // data bytes the item still needs
+  uint8_t shift;
+  uint32_t data;
+  uint16_t long_skip;   // bytes of a long item still to skip
+  uint8_t long_header;  // long item header bytes still to read
+  uint32_t total;
+} stream_t;
+
+// the one descriptor being fetched piecewise from a device
+static stream_t async_stream;
+
+static bool stream_begin(stream_t *st, uint8_t dev_addr, uint8_t instance)
+{
+  hid_report_map_t *map = NULL;
+  for (uint8_t i = 0; i < HID_MAP_SLOTS && !map; i++) {
+    // the async stream may have claimed a slot that isn't published yet
+    if (maps[i].dev_addr == 0 && !(async_stream.active && async_stream.p.map == &maps[i])) map = &maps[i];
+  }
+  if (!map) return false;
+
+  memset(map, 0, sizeof(*map));
+  memset(st, 0, sizeof(*st));
+  st->p.map = map;
+  st->dev_addr = dev_addr;
+  st->instance = instance;
+  st->active = true;
+
+  return true;
+}
+
+static void stream_feed(stream_t *st, uint8_t const *data, uint16_t len)
+{
+  if (!st->active) return;
+  st->total += len;
+
+  for (uint16_t pos = 0; pos < len; pos++) {
+    uint8_t b = data[pos];
+
+    // long item: 2 header bytes (size, tag), then the data we don't use
+    if (st->long_header) {
+      if (st->long_header == 2) st->long_skip = b;
+      st->long_header--;
+      continue;
+    }
+    if (st->long_skip) {
+      st->long_skip--;
+      continue;
+    }
+
+    if (!st->prefix) {
+      if (b == 0xFE) {
+        st->long_header = 2;
+        continue;
+      }
+
+      st->prefix = b;
+      st->need = (b & 0x03) == 3 ? 4 : (b & 0x03);
+      st->shift = 0;
+      st->data = 0;
+    } else {
+      st->data |= (uint32_t) b << st->shift;
+      st->shift += 8;
+      st->need--;
+    }
+
+    if (!st->need) {
+      uint8_t prefix = st->prefix;
+      uint8_t size = (prefix & 0x03) == 3 ? 4 : (prefix & 0x03);
+
+      parse_item(&st->p, (prefix >> 2) & 0x03, prefix >> 4, st->data, size);
+      st->prefix = 0;
+    }
+  }
+}
+
+static hid_report_map_t const *stream_end(stream_t *st)
+{
+  if (!st->active) return NULL;
+  st->active = false;
+
+  hid_report_map_t *map = st->p.map;
+  if (!map->n_fields) return NULL;
+
+  map->dev_addr = st->dev_addr;
+  map->instance = st->instance;
+  return map;
+}
+
+bool hid_map_stream_begin(uint8_t dev_addr, uint8_t instance)
+{
+  if (async_stream.active) return false;
+  return stream_begin(&async_stream, dev_addr, instance);
+}
+
+void hid_map_stream_feed(uint8_t const *data, uint16_t len)
+{
+  stream_feed(&async_stream, data, len);
+}
+
+hid_report_map_t const *hid_map_stream_end(void)
+{
+  return stream_end(&async_stream);
+}
+
+void hid_map_stream_abort(void)
+{
+  async_stream.active = false;
+}
+
+uint32_t hid_map_stream_bytes(void)
+{
+  return async_stream.total;
+}
+
+hid_report_map_t const *hid_map_parse(uint8_t dev_addr, uint8_t instance, uint8_t const *desc, uint16_t len)
+{
+  if (!desc || !len) return NULL;
+
+  stream_t st;
+  if (!stream_begin(&st, dev_addr, instance)) return NULL;
+
+  stream_feed(&st, desc, len);
+  return stream_end(&st);
+}
+
+//--------------------------------------------------------------------+
+// Extractor
+//--------------------------------------------------------------------+
+
+static uint32_t get_bits(uint8_t const *buf, uint16_t len, uint32_t bit_offset, uint8_t size)
+{
+  uint32_t byte = bit_offset >> 3;
+  uint64_t raw = 0;
+
+  for (uint8_t i = 0; i < 5 && byte + i < len; i++) {
+    raw |= (uint64_t) buf[byte + i] << (8 * i);
+  }
+
+  raw >>= bit_offset & 7;
+  return size == 32 ? (uint32_t) raw : (uint32_t) raw & ((1u << size) - 1);
+}
+
+static int32_t get_signed(hid_field_t const *f, uint8_t const *buf, uint16_t len, uint32_t bit_offset)
+{
+  uint32_t v = get_bits(buf, len, bit_offset, f->bit_size);
+  if (f->is_signed && f->bit_size < 32 && (v & (1u << (f->bit_size - 1)))) {
+    v |= ~((1u << f->bit_size) - 1);
+  }
+  return (int32_t) v;
+}
+
+static int8_t clamp8(int32_t v)
+{
+  return (int8_t) (v > 127 ? 127 : v < -127 ? -127 : v);
+}
+
+// stretch an axis over its logical range onto -127..127
+static int8_t scale_axis(hid_field_t const *f, int32_t v)
+{
+  int64_t range = (int64_t) f->logical_max - f->logical_min;
+  if (range <= 0) return clamp8(v);
+  return clamp8((int32_t) (((int64_t) v - f->logical_min) * 254 / range - 127));
+}
+
+static void set_consumer(hid_input_t *out, uint32_t usage)
+{
+  if (usage && !out->consumer) out->consumer = (uint16_t) usage;
+}
+
+static void extract_bitmap(hid_field_t const *f, uint8_t const *buf, uint16_t len, key_bitmap_t *keys)
+{
+  // byte aligned on both sides (modifiers, most NKRO layouts): copy whole bytes
+  if ((f->bit_offset & 7) == 0 && (f->usage_min & 7) == 0) {
+    uint8_t *dst = (uint8_t *) keys->w;
+    uint16_t src = f->bit_offset >> 3;
+    uint16_t nbytes = (uint16_t) ((f->count + 7) >> 3);
+
+    for (uint16_t i = 0; i < nbytes && src + i < len; i++) {
+      uint16_t d = (uint16_t) ((f->usage_min >> 3) + i);
+      if (d >= sizeof(keys->w)) break;
+      uint8_t bits = buf[src + i];
+      // last byte may be only partly ours
+      if (i == nbytes - 1 && (f->count & 7)) bits &= (uint8_t) ((1u << (f->count & 7)) - 1);
+      dst[d] |= bits;
+    }
+    return;
+  }
+
+  for (uint8_t n = 0; n < f->count; n++) {
+    if (get_bits(buf, len, f->bit_offset + n, 1)) {
+      uint32_t usage = f->usage_min + n;
+      if (usage < 256) key_bitmap_set(keys, (uint8_t) usage);
+    }
+  }
+}
+
+bool hid_map_extract(hid_report_map_t const *map, uint8_t const *report, uint16_t len, hid_input_t *out)
+{
+  uint8_t report_id = 0;
+  if (map->has_report_id) {
+    if (len < 1) return false;
+    report_id = report[0];
+    report++;
+    len--;
+  }
+
+  memset(out, 0, sizeof(*out));
+
+  for (uint8_t i = 0; i < map->n_fields; i++) {
+    hid_field_t const *f = &map->fields[i];
+    if (f->report_id != report_id) continue;
+
+    switch (f->kind) {
+      case HID_FIELD_KEY_ARRAY:
+        out->has_keys = true;
+        for (uint8_t n = 0; n < f->count; n++) {
+          int32_t v = (int32_t) get_bits(report, len, f->bit_offset + n * f->bit_size, f->bit_size) - f->logical_min;
+          uint32_t usage = f->usage_min + (uint32_t) v;
+          // 0 = no key, 1 = ErrorRollOver: keep the previous state
+          if (usage == 0x01) return false;
+          if (usage > 0x03 && usage < 256) key_bitmap_set(&out->keys, (uint8_t) usage);
+        }
+        break;
+
+      case HID_FIELD_KEY_BITMAP:
+        out->has_keys = true;
+        extract_bitmap(f, report, len, &out->keys);
+        break;
+
+      case HID_FIELD_BUTTONS:
+        out->has_mouse = true;
+        for (uint8_t n = 0; n < f->count; n++) {
+          uint32_t button = f->usage_min + n;  // button usages start at 1
+          if (button >= 1 && button <= 8 && get_bits(report, len, f->bit_offset + n, 1)) {
+            out->mouse.buttons |= (uint8_t) (1u << (button - 1));
+          }
+        }
+        break;
+
+      case HID_FIELD_MOUSE_X:
+        out->has_mouse = true;
+        out->mouse.x = clamp8(get_signed(f, report, len, f->bit_offset));
+        break;
+
+      case HID_FIELD_MOUSE_Y:
+        out->has_mouse = true;
+        out->mouse.y = clamp8(get_signed(f, report, len, f->bit_offset));
+        break;
+
+      case HID_FIELD_WHEEL:
+        out->has_mouse = true;
+        out->mouse.wheel = clamp8(get_signed(f, report, len, f->bit_offset));
+        break;
+
+      case HID_FIELD_PAN:
+        out->has_mouse = true;
+        out->mouse.pan = clamp8(get_signed(f, report, len, f->bit_offset));
+        break;
+
+      case HID_FIELD_CONSUMER_ARRAY:
+        out->has_consumer = true;
+        for (uint8_t n = 0; n < f->count; n++) {
+          int32_t v = (int32_t) get_bits(report, len, f->bit_offset + n * f->bit_size, f->bit_size) - f->logical_min;
+          if (v > 0 || f->usage_min) set_consumer(out, f->usage_min + (uint32_t) v);
+        }
+        break;
+
+      case HID_FIELD_CONSUMER_BITMAP:
+      case HID_FIELD_CONSUMER_FLAG:
+        out->has_consumer = true;
+        for (uint8_t n = 0; n < f->count; n++) {
+          if (get_bits(report, len, f->bit_offset + n, 1)) set_consumer(out, f->usage_min + n);
+        }
+        break;
+
+      case HID_FIELD_GAMEPAD_AXIS: {
+        out->has_gamepad = true;
+        int8_t v = scale_axis(f, get_signed(f, report, len, f->bit_offset));
+        switch (f->usage_min) {
+          case USAGE_DESKTOP_X:  out->gamepad.x = v; break;
+          case USAGE_DESKTOP_Y:  out->gamepad.y = v; break;
+          case USAGE_DESKTOP_Z:  out->gamepad.z = v; break;
+          case USAGE_DESKTOP_RX: out->gamepad.rx = v; break;
+          case USAGE_DESKTOP_RY: out->gamepad.ry = v; break;
+          case USAGE_DESKTOP_RZ: out->gamepad.rz = v; break;
+          default: break;
+        }
+        break;
+      }
+
+      case HID_FIELD_GAMEPAD_HAT: {
+        out->has_gamepad = true;
+        // 8 directions from up, clockwise; anything outside is the null state
+        int32_t v = get_signed(f, report, len, f->bit_offset) - f->logical_min;
+        out->gamepad.hat = (v >= 0 && v < 8) ? (uint8_t) (GAMEPAD_HAT_UP + v) : GAMEPAD_HAT_CENTERED;
+        break;
+      }
+
+      case HID_FIELD_GAMEPAD_BUTTONS:
+        out->has_gamepad = true;
+        for (uint8_t n = 0; n < f->count; n++) {
+          uint32_t button = f->usage_min + n;
+          if (button >= 1 && button <= 32 && get_bits(report, len, f->bit_offset + n, 1)) {
+            out->gamepad.buttons |= 1u << (button - 1);
+          }
+        }
+        break;
+
+      default: break;
+    }
+  }
+
+  return out->has_keys || out->has_mouse || out->has_consumer || out->has_gamepad;
+}
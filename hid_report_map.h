@@ -0,0 +1,89 @@
+#ifndef HID_REPORT_MAP_H_
+#define HID_REPORT_MAP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tusb.h"
+#include "key_diff.h"
+
+// interfaces with a parsed map, one per host HID interface
+#ifndef HID_MAP_SLOTS
+#define HID_MAP_SLOTS CFG_TUH_HID
+#endif
+
+// input fields kept per interface, anything beyond is ignored
+#ifndef HID_MAP_MAX_FIELDS
+#define HID_MAP_MAX_FIELDS 16
+#endif
+
+typedef enum {
+  HID_FIELD_KEY_ARRAY = 1,  // count slots of bit_size, each holds a keyboard usage
+  HID_FIELD_KEY_BITMAP,     // count 1-bit flags, usage_min + n (NKRO, modifiers)
+  HID_FIELD_BUTTONS,        // count 1-bit mouse buttons starting at button usage_min
+  HID_FIELD_MOUSE_X,
+  HID_FIELD_MOUSE_Y,
+  HID_FIELD_WHEEL,
+  HID_FIELD_PAN,
+  HID_FIELD_CONSUMER_ARRAY,   // count slots of bit_size, each holds a consumer usage
+  HID_FIELD_CONSUMER_BITMAP,  // count 1-bit flags, usage_min + n
+  HID_FIELD_CONSUMER_FLAG,    // one 1-bit flag for usage_min, from an explicit usage list
+  HID_FIELD_GAMEPAD_AXIS,     // one joystick/gamepad axis, usage_min says which
+  HID_FIELD_GAMEPAD_HAT,
+  HID_FIELD_GAMEPAD_BUTTONS,  // count 1-bit buttons starting at button usage_min
+} hid_field_kind_t;
+
+// one input field, found once at mount time
+typedef struct {
+  uint16_t bit_offset;  // from the first byte after the report ID
+  uint8_t bit_size;
+  uint8_t count;
+  uint8_t report_id;    // 0 if the interface doesn't use report IDs
+  uint8_t kind;         // hid_field_kind_t
+  uint8_t is_signed;
+  uint8_t reserved;
+  uint16_t usage_min;
+  int32_t logical_min;
+  int32_t logical_max;
+} hid_field_t;
+
+typedef struct {
+  uint8_t dev_addr;     // 0 = free
+  uint8_t instance;
+  bool has_report_id;
+  uint8_t n_fields;
+  uint16_t kinds;       // bit (1 << kind) set for every kind present
+  hid_field_t fields[HID_MAP_MAX_FIELDS];
+} hid_report_map_t;
+
+// everything the extractor pulled out of one report
+typedef struct {
+  bool has_keys;
+  bool has_mouse;
+  bool has_consumer;
+  bool has_gamepad;
+  uint16_t consumer;    // first consumer usage down, 0 = none
+  key_bitmap_t keys;
+  hid_mouse_report_t mouse;
+  hid_gamepad_report_t gamepad;
+} hid_input_t;
+
+// parse a whole report descriptor of an interface into its field map, NULL if nothing usable
+hid_report_map_t const *hid_map_parse(uint8_t dev_addr, uint8_t instance, uint8_t const *desc, uint16_t len);
+
+// Incremental form of hid_map_parse() for descriptors too large to buffer:
+// begin, feed the bytes in pieces of any size as they arrive, then end.
+// One such descriptor at a time. feed is safe to call from the host frame IRQ.
+bool hid_map_stream_begin(uint8_t dev_addr, uint8_t instance);
+void hid_map_stream_feed(uint8_t const *data, uint16_t len);
+hid_report_map_t const *hid_map_stream_end(void);
+void hid_map_stream_abort(void);
+uint32_t hid_map_stream_bytes(void);
+
+hid_report_map_t const *hid_map_find(uint8_t dev_addr, uint8_t instance);
+void hid_map_release(uint8_t dev_addr, uint8_t instance);
+
+// decode a report with the map built at mount, no descriptor walking here
+bool hid_map_extract(hid_report_map_t const *map, uint8_t const *report, uint16_t len, hid_input_t *out);
+
+#endif /* HID_REPORT_MAP_H_ */
@@ -0,0 +1,56 @@
+#include <stdio.h>
+
+#include "pico/stdlib.h"
+#include "tusb.h"
+
+#include "jobs.h"
+
+static job_t *current = NULL;
+
+bool jobs_start(job_t *job)
+{
+  if (current) return false;
+
+  job->phase = 0;
+  job->done = 0;
+  job->total = 0;
+  job->started_ms = to_ms_since_boot(get_absolute_time());
+  current = job;
+  return true;
+}
+
+job_t const *jobs_current(void)
+{
+  return current;
+}
+
+bool jobs_cancel(void)
+{
+  if (!current || !current->cancel) return false;
+
+  current->cancel(current);
+  current = NULL;
+  return true;
+}
+
+void jobs_task(void)
+{
+  if (!current) return;
+
+  uint32_t const start = time_us_32();
+  int rc;
+
+  do {
+    rc = current->step(current);
+  } while (rc == JOB_MORE && time_us_32() - start < JOBS_SLICE_US);
+
+  if (rc > JOB_DONE) return;
+
+  // jobs report their own success, failures are reported here
+  if (rc < 0) {
+    char buf[64];
+    int count = snprintf(buf, sizeof(buf), "\r\n%s failed (%d)\r\n", current->name, rc);
+    tud_cdc_write(buf, count);
+  }
+  current = NULL;
+}
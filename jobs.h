@@ -0,0 +1,47 @@
+#ifndef JOBS_H_
+#define JOBS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Long CLI commands run as jobs: the command only starts one, the core0 loop
+// moves it along in short slices between tud_task() calls, so USB and HID
+// forwarding never wait for a whole dump or format. One job at a time.
+
+// time a job may take per loop, a step that started runs to its end
+#ifndef JOBS_SLICE_US
+#define JOBS_SLICE_US 500
+#endif
+
+// step results, or a negative LittleFS error code
+enum {
+  JOB_DONE = 0,
+  JOB_MORE,       // call again, this loop if the slice has time left
+  JOB_WAIT,       // waiting for something, call again next loop
+};
+
+typedef struct job job_t;
+
+struct job {
+  char const *name;
+  int (*step)(job_t *job);      // one bounded piece of work
+  void (*cancel)(job_t *job);   // NULL if it can't be stopped halfway
+  uint8_t phase;                // the job's own, 0 when started
+  uint32_t done;                // progress, in whatever unit total counts
+  uint32_t total;               // 0 if unknown
+  uint32_t started_ms;
+};
+
+// false if another job is running
+bool jobs_start(job_t *job);
+
+// the running job, NULL if none
+job_t const *jobs_current(void);
+
+// stop the running job, false if there is none or it can't be stopped
+bool jobs_cancel(void);
+
+// run a slice of the current job, call from the core0 loop
+void jobs_task(void);
+
+#endif /* JOBS_H_ */
@@ -0,0 +1,811 @@
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "hardware/flash.h"
+
+#include "flash_sched.h"
+#include "journal.h"
+
+// Segment: seg_header_t, then records back to back, then erased flash.
+// Record:  rec_header_t, then len payload bytes. A record may cross a page
+// boundary but never a segment boundary.
+//
+// The page being filled lives in RAM and is handed to the flash scheduler
+// once it is full, which programs it when the USB host can spare the time. A
+// sync hands it over early; the same page is programmed again when more bytes
+// arrive, rewriting the bytes already there with the same value, which NOR
+// flash allows.
+//
+// Readers only see what is in flash: flash_sched moves a watermark (a log
+// offset) along as it programs the pages, so a segment whose erase or header
+// is still queued reads as empty, whatever its previous occupant left there.
+//
+// journal_sync() closes a batch with a commit record. After a power loss,
+// mounting looks at the head segment only: complete records past its last
+// commit are voided (their type byte programmed to 0, which needs no erase)
+// so a batch is kept whole or not at all. Segments before the head were
+// closed by the one after them, except for the one right before it when the
+// head has no commit yet. Mount time is the segment headers plus at most two
+// segments, whatever the fill level.
+
+#define JOURNAL_MAGIC    0x4C4E524A  // "JRNL", superblock file
+#define SEGMENT_MAGIC    0x4745534A  // "JSEG"
+#define JOURNAL_VERSION  1
+#define ERASED           0xFF
+
+// record types of the journal's own, never handed to readers
+#define REC_VOID         0x00        // rolled back while mounting
+#define REC_COMMIT       0xFE        // end of a batch, no payload
+
+// seg_header_t.format
+#define SEG_FORMAT_BATCHES 1         // records are committed in batches
+
+#define PAGE_MASK (JOURNAL_PAGE_SIZE - 1)
+
+static_assert(JOURNAL_SEGMENT_SIZE == FLASH_SECTOR_SIZE, "a segment must be one erase sector");
+static_assert(JOURNAL_PAGE_SIZE == FLASH_PAGE_SIZE, "pages must match the flash program size");
+
+// kept in LittleFS, says where the region is and how it is cut up
+typedef struct {
+  uint32_t magic;
+  uint16_t version;
+  uint16_t segment_size;
+  uint32_t offset;
+  uint32_t size;
+} journal_super_t;
+
+typedef struct {
+  uint32_t magic;
+  uint32_t seq;         // grows by one for every segment opened
+  uint32_t time_ms;     // journal clock when opened, erased (unknown) in older headers
+  uint8_t format;       // SEG_FORMAT_BATCHES, erased in older headers (every record stands alone)
+  uint8_t reserved;     // left erased
+  uint16_t crc;         // over everything before it
+} seg_header_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t len;
+  uint16_t crc;         // over type, len and payload
+} rec_header_t;
+
+static_assert(sizeof(seg_header_t) == 16, "segment header layout");
+static_assert(sizeof(rec_header_t) == 4, "record header layout");
+
+static lfs_t *j_lfs;
+static uint32_t region_offset;
+static uint16_t n_segments;
+static bool ready = false;
+
+static uint16_t head;           // segment being appended to
+static uint16_t oldest;
+static uint16_t used;           // segments holding data, oldest up to head
+static uint16_t prepared;       // erased segments right after head
+static uint32_t head_seq;
+static uint32_t write_pos;      // next free byte in head
+static uint32_t page_base;      // start of the page the RAM image holds
+static bool page_dirty;         // image has bytes not handed to flash_sched yet
+static uint32_t flashed;        // log offset everything before which is in flash
+static bool uncommitted;        // head has records past its last commit
+static uint8_t page[JOURNAL_PAGE_SIZE];
+
+// segments of a formatted log still to be invalidated, see journal_format()
+static uint16_t stale_first;
+static uint16_t stale_count;
+
+// the time index: when each segment was opened, 0 if unknown
+static uint32_t seg_time[JOURNAL_SIZE / JOURNAL_SEGMENT_SIZE];
+static uint32_t clock_base;     // journal clock at boot
+
+static journal_stats_t stats;
+static lat_hist_t append_latency;
+
+static uint16_t crc16(uint16_t crc, void const *data, uint32_t len)
+{
+  uint8_t const *p = data;
+
+  while (len--) {
+    crc ^= (uint16_t) (*p++ << 8);
+    for (uint8_t i = 0; i < 8; i++) {
+      crc = (crc & 0x8000) ? (uint16_t) ((crc << 1) ^ 0x1021) : (uint16_t) (crc << 1);
+    }
+  }
+  return crc;
+}
+
+static uint32_t seg_offset(uint16_t seg)
+{
+  return region_offset + (uint32_t) seg * JOURNAL_SEGMENT_SIZE;
+}
+
+static uint8_t const *seg_ptr(uint16_t seg)
+{
+  return (uint8_t const *) (XIP_BASE + seg_offset(seg));
+}
+
+//--------------------------------------------------------------------+
+// Flash access
+//--------------------------------------------------------------------+
+
+static int program_page(void)
+{
+  if (!page_dirty) return LFS_ERR_OK;
+
+  uint32_t const end = head_seq * JOURNAL_SEGMENT_SIZE + write_pos;
+  int err = flash_sched_program_mark(seg_offset(head) + page_base, page, &flashed, end);
+  if (err != LFS_ERR_OK) return err;
+
+  stats.pages_programmed++;
+  page_dirty = false;
+  return LFS_ERR_OK;
+}
+
+//--------------------------------------------------------------------+
+// Writing
+//--------------------------------------------------------------------+
+
+// program the image once it is full and move on to a fresh one
+static int next_page(void)
+{
+  if (write_pos - page_base < JOURNAL_PAGE_SIZE) return LFS_ERR_OK;
+
+  int err = program_page();
+  if (err != LFS_ERR_OK) return err;
+
+  page_base += JOURNAL_PAGE_SIZE;
+  memset(page, ERASED, sizeof(page));
+  return LFS_ERR_OK;
+}
+
+static int put_bytes(void const *data, uint32_t len)
+{
+  uint8_t const *src = data;
+
+  for (;;) {
+    int err = next_page();
+    if (err != LFS_ERR_OK || len == 0) return err;
+
+    uint32_t in_page = write_pos - page_base;
+    uint32_t n = JOURNAL_PAGE_SIZE - in_page;
+    if (n > len) n = len;
+
+    memcpy(&page[in_page], src, n);
+    page_dirty = true;
+    write_pos += n;
+    src += n;
+    len -= n;
+  }
+}
+
+static bool seg_blank(uint16_t seg)
+{
+  uint32_t const *p = (uint32_t const *) seg_ptr(seg);
+
+  for (uint32_t i = 0; i < JOURNAL_SEGMENT_SIZE / sizeof(uint32_t); i++) {
+    if (p[i] != 0xFFFFFFFF) return false;
+  }
+  return true;
+}
+
+static int open_segment(uint16_t seg)
+{
+  if (prepared) {
+    // journal_prepare() already took care of it
+    prepared--;
+  } else {
+    int err = flash_sched_erase(seg_offset(seg));
+    if (err != LFS_ERR_OK) return err;
+    stats.segments_erased++;
+  }
+
+  head = seg;
+  head_seq++;
+  write_pos = 0;
+  page_base = 0;
+  page_dirty = false;
+  uncommitted = false;
+  memset(page, ERASED, sizeof(page));
+
+  seg_header_t h;
+  memset(&h, ERASED, sizeof(h));
+  h.magic = SEGMENT_MAGIC;
+  h.seq = head_seq;
+  h.time_ms = journal_time_ms();
+  h.format = SEG_FORMAT_BATCHES;
+  seg_time[seg] = h.time_ms;
+  h.crc = crc16(0xFFFF, &h, offsetof(seg_header_t, crc));
+
+  return put_bytes(&h, sizeof(h));
+}
+
+// O(1): the segment is only forgotten here, its erase comes with its reuse
+static void evict_oldest(void)
+{
+  oldest = (uint16_t) ((oldest + 1) % n_segments);
+  used--;
+  stats.segments_evicted++;
+}
+
+static int put_record(uint8_t type, const void *data, uint16_t len)
+{
+  if (write_pos + sizeof(rec_header_t) + len > JOURNAL_SEGMENT_SIZE) {
+    if (!prepared && used == n_segments) {
+      if (!JOURNAL_RING || used < 2) {
+        stats.errors++;
+        return LFS_ERR_NOSPC;
+      }
+      evict_oldest();
+    }
+
+    int err = program_page();
+    if (err != LFS_ERR_OK) return err;
+
+    err = open_segment((uint16_t) ((head + 1) % n_segments));
+    if (err != LFS_ERR_OK) return err;
+    used++;
+  }
+
+  rec_header_t h = { type, (uint8_t) len, 0 };
+  h.crc = crc16(crc16(0xFFFF, &h, 2), data, len);
+
+  int err = put_bytes(&h, sizeof(h));
+  if (err == LFS_ERR_OK) err = put_bytes(data, len);
+  return err;
+}
+
+static int append(uint8_t type, const void *data, uint16_t len)
+{
+  int err = put_record(type, data, len);
+  if (err != LFS_ERR_OK) return err;
+
+  uncommitted = true;
+  stats.records++;
+  stats.bytes += len;
+  return LFS_ERR_OK;
+}
+
+static int commit(void)
+{
+  if (!uncommitted) return LFS_ERR_OK;
+
+  int err = put_record(REC_COMMIT, NULL, 0);
+  if (err != LFS_ERR_OK) return err;
+
+  uncommitted = false;
+  stats.commits++;
+  return LFS_ERR_OK;
+}
+
+int journal_append(uint8_t type, const void *data, uint16_t len)
+{
+  if (!ready) return LFS_ERR_BADF;
+  if (len > JOURNAL_RECORD_MAX || type == ERASED || type == REC_VOID || type == REC_COMMIT) return LFS_ERR_INVAL;
+
+  uint32_t start = time_us_32();
+  int err = append(type, data, len);
+  lat_hist_add(&append_latency, time_us_32() - start);
+  return err;
+}
+
+int journal_sync(void)
+{
+  if (!ready) return LFS_ERR_BADF;
+
+  int err = commit();
+  if (err != LFS_ERR_OK) return err;
+  return program_page();
+}
+
+int journal_flush(void)
+{
+  int err = journal_sync();
+  if (err != LFS_ERR_OK) return err;
+  return flash_sched_flush();
+}
+
+//--------------------------------------------------------------------+
+// Reading and mounting
+//--------------------------------------------------------------------+
+
+// how much of the segment with this sequence number is in flash
+static uint32_t flashed_limit(uint32_t seq)
+{
+  uint32_t const start = seq * JOURNAL_SEGMENT_SIZE;
+
+  if (flashed <= start) return 0;
+  if (flashed - start >= JOURNAL_SEGMENT_SIZE) return JOURNAL_SEGMENT_SIZE;
+  return flashed - start;
+}
+
+// sequence number of a segment between oldest and head, without trusting its
+// header: it may still be the previous occupant's until the erase has run
+static uint32_t seg_seq(uint16_t seg)
+{
+  return head_seq - (uint16_t) ((head + n_segments - seg) % n_segments);
+}
+
+static bool read_header_format(uint16_t seg, uint32_t *seq, uint8_t *format)
+{
+  seg_header_t h;
+  seg_time[seg] = 0;
+  memcpy(&h, seg_ptr(seg), sizeof(h));
+
+  if (h.magic != SEGMENT_MAGIC || h.crc != crc16(0xFFFF, &h, offsetof(seg_header_t, crc))) return false;
+
+  *seq = h.seq;
+  *format = h.format;
+  seg_time[seg] = h.time_ms == UINT32_MAX ? 0 : h.time_ms;
+  return true;
+}
+
+static bool read_header(uint16_t seg, uint32_t *seq)
+{
+  uint8_t format;
+  return read_header_format(seg, seq, &format);
+}
+
+static bool page_tail_erased(uint16_t seg, uint32_t pos)
+{
+  uint8_t const *p = seg_ptr(seg);
+  uint32_t end = (pos & ~PAGE_MASK) + JOURNAL_PAGE_SIZE;
+
+  for (; pos < end; pos++) {
+    if (p[pos] != ERASED) return false;
+  }
+  return true;
+}
+
+// length of the record at pos, 0 where the data ends, -1 if it is damaged
+static int32_t check_record(uint16_t seg, uint32_t pos, uint32_t limit)
+{
+  if (pos + sizeof(rec_header_t) > limit) return 0;
+
+  uint8_t const *p = seg_ptr(seg) + pos;
+  if (p[0] == ERASED) return page_tail_erased(seg, pos) ? 0 : -1;
+
+  rec_header_t h;
+  memcpy(&h, p, sizeof(h));
+
+  uint32_t total = sizeof(h) + h.len;
+  // past the limit of a segment not all in flash yet: still queued if it
+  // ends before what was written, otherwise what is left of a write cut
+  // short before a reboot
+  uint32_t const written = seg == head ? write_pos : JOURNAL_SEGMENT_SIZE;
+  if (pos + total > limit) return limit < JOURNAL_SEGMENT_SIZE && pos + total <= written ? 0 : -1;
+
+  // voided after its CRC was checked, only the length still counts
+  if (h.type == REC_VOID) return (int32_t) total;
+
+  uint16_t crc = crc16(crc16(0xFFFF, p, 2), p + sizeof(h), h.len);
+  return crc == h.crc ? (int32_t) total : -1;
+}
+
+static uint32_t skip_page(uint32_t pos)
+{
+  return (pos & ~PAGE_MASK) + JOURNAL_PAGE_SIZE;
+}
+
+// void the complete records of seg from pos up to end, a batch that was never committed
+static int roll_back(uint16_t seg, uint32_t pos, uint32_t end)
+{
+  uint32_t image = UINT32_MAX;
+  int err = LFS_ERR_OK;
+
+  while (pos < end && err == LFS_ERR_OK) {
+    int32_t n = check_record(seg, pos, JOURNAL_SEGMENT_SIZE);
+    if (n <= 0) {
+      pos = skip_page(pos);
+      continue;
+    }
+
+    uint8_t const type = seg_ptr(seg)[pos];
+    if (type != REC_VOID) {
+      if ((pos & ~PAGE_MASK) != image) {
+        if (image != UINT32_MAX) err = flash_sched_program(seg_offset(seg) + image, page);
+        image = pos & ~PAGE_MASK;
+        memcpy(page, seg_ptr(seg) + image, JOURNAL_PAGE_SIZE);
+      }
+      page[pos & PAGE_MASK] = REC_VOID;
+      if (type != REC_COMMIT) stats.rolled_back++;
+    }
+    pos += (uint32_t) n;
+  }
+
+  if (image != UINT32_MAX && err == LFS_ERR_OK) err = flash_sched_program(seg_offset(seg) + image, page);
+  if (err == LFS_ERR_OK) err = flash_sched_flush();
+  return err;
+}
+
+// end of the data in seg, past any write that was cut short, and the end of
+// its last commit
+static uint32_t scan_segment(uint16_t seg, uint32_t *committed)
+{
+  uint32_t pos = sizeof(seg_header_t);
+  *committed = pos;
+
+  while (pos < JOURNAL_SEGMENT_SIZE) {
+    int32_t n = check_record(seg, pos, JOURNAL_SEGMENT_SIZE);
+    if (n == 0) break;
+    if (n > 0) {
+      if (seg_ptr(seg)[pos] == REC_COMMIT) *committed = pos + (uint32_t) n;
+      pos += (uint32_t) n;
+      continue;
+    }
+    stats.torn++;
+    pos = skip_page(pos);
+  }
+  return pos;
+}
+
+// A batch (well under a segment) cut short by a power loss ends in the head;
+// if the head has no commit yet it may have started in the segment before.
+static int recover(uint8_t head_format, uint32_t *end)
+{
+  uint32_t committed;
+  *end = scan_segment(head, &committed);
+
+  if (head_format != SEG_FORMAT_BATCHES) return LFS_ERR_OK;
+
+  if (committed == sizeof(seg_header_t) && used > 1) {
+    uint16_t const prev = (uint16_t) ((head + n_segments - 1) % n_segments);
+    uint32_t seq, prev_committed;
+    uint8_t format;
+
+    if (read_header_format(prev, &seq, &format) && format == SEG_FORMAT_BATCHES) {
+      uint32_t prev_end = scan_segment(prev, &prev_committed);
+      if (prev_committed < prev_end) {
+        int err = roll_back(prev, prev_committed, prev_end);
+        if (err != LFS_ERR_OK) return err;
+      }
+    }
+  }
+
+  if (committed < *end) return roll_back(head, committed, *end);
+  return LFS_ERR_OK;
+}
+
+static int mount(void)
+{
+  uint32_t max_seq = 0;
+  uint32_t min_seq = UINT32_MAX;
+  uint8_t head_format = ERASED;
+  used = 0;
+
+  for (uint16_t seg = 0; seg < n_segments; seg++) {
+    uint32_t seq;
+    uint8_t format;
+    if (!read_header_format(seg, &seq, &format)) continue;
+
+    used++;
+    if (seq >= max_seq) {
+      max_seq = seq;
+      head = seg;
+      head_format = format;
+    }
+    if (seq < min_seq) {
+      min_seq = seq;
+      oldest = seg;
+    }
+  }
+
+  if (!used) {
+    head_seq = 0;
+    flashed = 0;
+    oldest = 0;
+    used = 1;
+    return open_segment(0);
+  }
+
+  head_seq = max_seq;
+
+  // carry on from the head, the log clock mustn't go back after a reboot
+  clock_base = seg_time[head];
+
+  uint32_t pos;
+  int err = recover(head_format, &pos);
+  if (err != LFS_ERR_OK) return err;
+
+  write_pos = pos < JOURNAL_SEGMENT_SIZE ? pos : JOURNAL_SEGMENT_SIZE;
+  page_base = write_pos & ~PAGE_MASK;
+  page_dirty = false;
+  memset(page, ERASED, sizeof(page));
+  if (page_base < JOURNAL_SEGMENT_SIZE) {
+    memcpy(page, seg_ptr(head) + page_base, write_pos - page_base);
+  }
+  flashed = head_seq * JOURNAL_SEGMENT_SIZE + write_pos;
+
+  return LFS_ERR_OK;
+}
+
+uint16_t journal_prepare(void)
+{
+  if (!ready) return 0;
+
+  uint16_t queued = 0;
+
+  while (prepared < JOURNAL_PREPARE_SEGMENTS) {
+    if (used + prepared == n_segments) {
+      // the segment after the prepared ones is the oldest, keep the head and one more
+      if (!JOURNAL_RING || used <= 2) break;
+      evict_oldest();
+    }
+
+    uint16_t seg = (uint16_t) ((head + 1 + prepared) % n_segments);
+
+    if (!seg_blank(seg)) {
+      if (flash_sched_erase(seg_offset(seg)) != LFS_ERR_OK) break;
+      stats.segments_erased++;
+      stats.pre_erased++;
+      queued++;
+    }
+    prepared++;
+  }
+  return queued;
+}
+
+uint32_t journal_time_ms(void)
+{
+  return clock_base + to_ms_since_boot(get_absolute_time());
+}
+
+void journal_time_floor(uint32_t time_ms)
+{
+  uint32_t now = journal_time_ms();
+  if ((int32_t) (time_ms - now) >= 0) clock_base += time_ms - now + 1;
+}
+
+void journal_seek(journal_cursor_t *cursor, uint32_t time_ms)
+{
+  // segments hold data oldest..head in time order, find the last one opened
+  // at or before time_ms
+  uint16_t lo = 0;
+  uint16_t hi = used;
+
+  while (hi - lo > 1) {
+    uint16_t mid = (uint16_t) ((lo + hi) / 2);
+    if (seg_time[(oldest + mid) % n_segments] <= time_ms) {
+      lo = mid;
+    } else {
+      hi = mid;
+    }
+  }
+
+  cursor->seg = (uint16_t) ((oldest + lo) % n_segments);
+  cursor->pos = sizeof(seg_header_t);
+  cursor->seq = seg_seq(cursor->seg);
+}
+
+void journal_rewind(journal_cursor_t *cursor)
+{
+  cursor->seg = oldest;
+  cursor->pos = sizeof(seg_header_t);
+  cursor->seq = seg_seq(oldest);
+}
+
+bool journal_next(journal_cursor_t *cursor, journal_record_t *record)
+{
+  if (!ready) return false;
+
+  // the segment being read was evicted meanwhile, carry on with the oldest left
+  if (cursor->seq + used <= head_seq) journal_rewind(cursor);
+
+  for (;;) {
+    bool const is_head = cursor->seg == head;
+    // only what is already in flash can be read
+    uint32_t const limit = flashed_limit(cursor->seq);
+
+    int32_t n = check_record(cursor->seg, cursor->pos, limit);
+    if (n > 0) {
+      uint8_t const *p = seg_ptr(cursor->seg) + cursor->pos;
+      cursor->pos = (uint16_t) (cursor->pos + n);
+
+      if (p[0] == JOURNAL_REC_BENCH || p[0] == REC_VOID || p[0] == REC_COMMIT) continue;
+
+      record->type = p[0];
+      record->len = p[1];
+      record->data = p + sizeof(rec_header_t);
+      return true;
+    }
+
+    if (n < 0) {
+      cursor->pos = (uint16_t) skip_page(cursor->pos);
+      continue;
+    }
+
+    // the rest is still queued, carry on from here next time
+    if (is_head || limit < JOURNAL_SEGMENT_SIZE) return false;
+
+    cursor->seg = (uint16_t) ((cursor->seg + 1) % n_segments);
+    cursor->pos = sizeof(seg_header_t);
+    cursor->seq++;
+  }
+}
+
+void journal_extent(uint32_t *start, uint32_t *end)
+{
+  if (!ready) {
+    *start = *end = 0;
+    return;
+  }
+
+  *start = (head_seq - used + 1) * JOURNAL_SEGMENT_SIZE;
+  // right after a format the new log may have nothing in flash yet
+  *end = flashed > *start ? flashed : *start;
+}
+
+int journal_read_raw(uint32_t offset, void *buf, uint16_t len)
+{
+  if (!ready) return LFS_ERR_BADF;
+
+  uint32_t const seq = offset / JOURNAL_SEGMENT_SIZE;
+  uint32_t const pos = offset % JOURNAL_SEGMENT_SIZE;
+
+  if (seq > head_seq) return 0;
+  if (head_seq - seq >= used) return LFS_ERR_NOENT;
+
+  uint16_t const seg = (uint16_t) ((head + n_segments - (head_seq - seq)) % n_segments);
+  uint32_t const limit = flashed_limit(seq);
+
+  if (pos >= limit) return 0;
+  if (len > limit - pos) len = (uint16_t) (limit - pos);
+
+  memcpy(buf, seg_ptr(seg) + pos, len);
+  return len;
+}
+
+//--------------------------------------------------------------------+
+// Setup
+//--------------------------------------------------------------------+
+
+// LFS_ERR_OK if the superblock file describes this region, LFS_ERR_NOENT if
+// there is none, LFS_ERR_INVAL if it describes another one
+static int check_super(void)
+{
+  lfs_file_t file;
+  journal_super_t sb;
+
+  int err = lfs_file_open(j_lfs, &file, JOURNAL_SUPER_FILENAME, LFS_O_RDONLY);
+  if (err != LFS_ERR_OK) return err == LFS_ERR_NOENT ? LFS_ERR_NOENT : LFS_ERR_INVAL;
+  lfs_ssize_t n = lfs_file_read(j_lfs, &file, &sb, sizeof(sb));
+  lfs_file_close(j_lfs, &file);
+
+  bool const match = n == sizeof(sb) && sb.magic == JOURNAL_MAGIC && sb.version == JOURNAL_VERSION &&
+                     sb.segment_size == JOURNAL_SEGMENT_SIZE && sb.offset == region_offset &&
+                     sb.size == (uint32_t) n_segments * JOURNAL_SEGMENT_SIZE;
+  return match ? LFS_ERR_OK : LFS_ERR_INVAL;
+}
+
+static bool region_has_segments(void)
+{
+  for (uint16_t seg = 0; seg < n_segments; seg++) {
+    uint32_t seq;
+    if (read_header(seg, &seq)) return true;
+  }
+  return false;
+}
+
+static int save_super(void)
+{
+  journal_super_t const sb = {
+    .magic = JOURNAL_MAGIC,
+    .version = JOURNAL_VERSION,
+    .segment_size = JOURNAL_SEGMENT_SIZE,
+    .offset = region_offset,
+    .size = (uint32_t) n_segments * JOURNAL_SEGMENT_SIZE,
+  };
+
+  lfs_file_t file;
+  int err = lfs_file_open(j_lfs, &file, JOURNAL_SUPER_FILENAME, LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
+  if (err != LFS_ERR_OK) return err;
+
+  lfs_ssize_t n = lfs_file_write(j_lfs, &file, &sb, sizeof(sb));
+  err = lfs_file_close(j_lfs, &file);
+
+  return n < 0 ? (int) n : err;
+}
+
+int journal_init(lfs_t *lfs, uint32_t flash_offset, uint32_t size)
+{
+  j_lfs = lfs;
+  region_offset = flash_offset;
+  n_segments = (uint16_t) (size / JOURNAL_SEGMENT_SIZE);
+  prepared = 0;
+  stale_count = 0;
+  ready = false;
+
+  if ((flash_offset % JOURNAL_SEGMENT_SIZE) || n_segments < 2 || size > JOURNAL_SIZE) return LFS_ERR_INVAL;
+
+  int err = check_super();
+  if (err == LFS_ERR_NOENT && region_has_segments()) {
+    // LittleFS was formatted under a journal that is still there, keep it
+    err = save_super();
+    if (err != LFS_ERR_OK) return err;
+    stats.adopted = true;
+  } else if (err != LFS_ERR_OK) {
+    // new region, or it moved: nothing in it belongs to us
+    err = flash_sched_erase_now(region_offset, (uint32_t) n_segments * JOURNAL_SEGMENT_SIZE);
+    if (err != LFS_ERR_OK) return err;
+    stats.segments_erased += n_segments;
+
+    err = save_super();
+    if (err != LFS_ERR_OK) return err;
+  }
+
+  uint32_t start = time_us_32();
+  err = mount();
+  stats.mount_us = time_us_32() - start;
+
+  ready = (err == LFS_ERR_OK);
+  return err;
+}
+
+// in use again: between oldest and the prepared segments past head
+static bool seg_live(uint16_t seg)
+{
+  return (uint16_t) ((seg + n_segments - oldest) % n_segments) < used + prepared;
+}
+
+int journal_format(void)
+{
+  if (!ready) return LFS_ERR_BADF;
+
+  // what is in RAM belongs to the old log
+  page_dirty = false;
+
+  stale_first = oldest;
+  stale_count = used;
+
+  // the new log starts right after the old head, keeping the sequence going
+  oldest = (uint16_t) ((head + 1) % n_segments);
+  used = 1;
+  return open_segment(oldest);
+}
+
+uint16_t journal_format_pending(void)
+{
+  return stale_count;
+}
+
+int journal_format_step(void)
+{
+  static uint8_t scratch[JOURNAL_PAGE_SIZE];
+
+  while (stale_count) {
+    uint16_t seg = stale_first;
+    stale_first = (uint16_t) ((seg + 1) % n_segments);
+    stale_count--;
+
+    // reused by the new log meanwhile (and erased for it), or nothing there
+    uint32_t seq;
+    if (seg_live(seg) || !read_header(seg, &seq)) continue;
+
+    // a broken magic is enough for mount() to pass it by, and NOR flash can
+    // clear bits without an erase
+    memcpy(scratch, seg_ptr(seg), sizeof(scratch));
+    memset(scratch, 0, sizeof(uint32_t));
+    return flash_sched_program(seg_offset(seg), scratch);
+  }
+  return LFS_ERR_OK;
+}
+
+void journal_get_stats(journal_stats_t *out)
+{
+  *out = stats;
+  out->segments_used = used;
+  out->segments_total = n_segments;
+  out->segments_prepared = prepared;
+  out->capacity_bytes = (uint32_t) n_segments * JOURNAL_SEGMENT_SIZE;
+  out->fill_bytes = ready ? (uint32_t) (used - 1) * JOURNAL_SEGMENT_SIZE + write_pos : 0;
+}
+
+lat_hist_t const *journal_append_latency(void)
+{
+  return &append_latency;
+}
+
+void journal_append_latency_reset(void)
+{
+  lat_hist_reset(&append_latency);
+}
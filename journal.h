@@ -0,0 +1,159 @@
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lfs.h"
+#include "latency.h"
+
+// Append-only log in its own flash region, next to (not inside) LittleFS.
+// The region is split into sector-sized segments written strictly in order.
+// Each segment starts with a small header and holds CRC-protected records.
+// Appending costs a page program once a page fills up, and never touches
+// filesystem metadata. Flash work goes through flash_sched. LittleFS only
+// keeps the superblock file that says where the region is.
+//
+// Appends are committed in batches by journal_sync(); a power loss drops the
+// batch that was cut short and nothing before it. Mounting reads the segment
+// headers and the last one or two segments only.
+//
+// In ring mode a full region drops its oldest segment to make room, so the
+// log keeps the most recent JOURNAL_SIZE (minus the prepared segments).
+
+// flash set aside for the journal, a multiple of JOURNAL_SEGMENT_SIZE
+#ifndef JOURNAL_SIZE
+#define JOURNAL_SIZE (224 * 1024)
+#endif
+
+#define JOURNAL_SEGMENT_SIZE 4096   // one erase sector
+#define JOURNAL_PAGE_SIZE    256    // one program page
+
+#define JOURNAL_SUPER_FILENAME "journal"
+
+// 1: evict the oldest segment when full, 0: refuse appends with LFS_ERR_NOSPC
+#ifndef JOURNAL_RING
+#define JOURNAL_RING 1
+#endif
+
+// free segments past the head kept erased by journal_prepare()
+#ifndef JOURNAL_PREPARE_SEGMENTS
+#define JOURNAL_PREPARE_SEGMENTS 2
+#endif
+
+// largest payload of one record
+#define JOURNAL_RECORD_MAX 255
+
+// record types, 0xFF is erased flash and never a valid type
+typedef enum {
+  JOURNAL_REC_TEXT = 1,   // logged keystrokes
+  JOURNAL_REC_BENCH,      // filler written by the benchmark, skipped when reading
+  JOURNAL_REC_TEXT_LZ,    // logged keystrokes, one log_compress() block
+  JOURNAL_REC_EVENTS,     // one event_log.h block
+} journal_rec_type_t;
+
+typedef struct {
+  uint8_t type;
+  uint8_t len;
+  uint8_t const *data;    // points into memory-mapped flash
+} journal_record_t;
+
+// position of a reader, start it with journal_rewind()
+typedef struct {
+  uint32_t seq;           // sequence number of the segment being read
+  uint16_t seg;
+  uint16_t pos;
+} journal_cursor_t;
+
+typedef struct {
+  uint32_t records;
+  uint32_t bytes;             // payload bytes appended
+  uint32_t pages_programmed;  // handed to the flash scheduler
+  uint32_t segments_erased;
+  uint32_t pre_erased;        // of those, erased ahead of time by journal_prepare()
+  uint32_t segments_evicted;  // dropped to make room in ring mode
+  uint32_t fill_bytes;        // used in the region, headers included
+  uint32_t capacity_bytes;
+  uint32_t torn;              // damaged records skipped while mounting
+  uint32_t commits;           // batches closed by journal_sync()
+  uint32_t rolled_back;       // records of an uncommitted batch dropped while mounting
+  uint32_t mount_us;          // time journal_init() took to find the head and recover it
+  bool adopted;               // superblock file was missing, the region was kept anyway
+  uint32_t errors;            // failed flash operations or appends that didn't fit
+  uint16_t segments_used;
+  uint16_t segments_total;
+  uint16_t segments_prepared; // erased and waiting past the head
+} journal_stats_t;
+
+// Find the region through the superblock file (creating both if needed) and
+// pick up where the last session stopped, rolling back a batch that was cut
+// short. A region found without its superblock file (LittleFS formatted
+// since) is kept. lfs must be mounted. Returns a LittleFS error code.
+int journal_init(lfs_t *lfs, uint32_t flash_offset, uint32_t size);
+
+// add one record, it reaches flash once its page is full or on journal_sync()
+int journal_append(uint8_t type, const void *data, uint16_t len);
+
+// close the batch appended so far with a commit record and queue the partly
+// filled page, so all of it reaches flash soon
+int journal_sync(void);
+
+// sync and wait until all of it is in flash
+int journal_flush(void);
+
+// Get the next free segments erased while nobody is typing, so an append
+// that fills the head only has to program pages. Segments already blank are
+// just counted. Returns how many erases were queued.
+uint16_t journal_prepare(void);
+
+// Start over with an empty log, right away and without erasing: the old
+// segments are left to journal_format_step(), which invalidates them one page
+// program at a time, and are erased when the ring reuses them. Until that is
+// done a reboot brings back what is left of the old log.
+int journal_format(void);
+
+// old segments still to be invalidated
+uint16_t journal_format_pending(void);
+
+// invalidate the next old segment, queueing at most one page program
+int journal_format_step(void);
+
+void journal_rewind(journal_cursor_t *cursor);
+
+// Journal clock in ms: time since boot plus where the log stopped before it,
+// so it only moves forward across reboots. Every segment header keeps the
+// clock of when it was opened, which makes the headers a time index with one
+// entry per JOURNAL_SEGMENT_SIZE.
+uint32_t journal_time_ms(void);
+
+// move the clock past time_ms, for a log writer that finds later times in
+// its records than the segment headers show
+void journal_time_floor(uint32_t time_ms);
+
+// start reading at the last segment opened at or before time_ms, a binary
+// search over the index; records of a segment can be older than its opening
+// if they were staged before, seek a little earlier to be sure
+void journal_seek(journal_cursor_t *cursor, uint32_t time_ms);
+
+// next record in append order, false at the end of what is in flash so far;
+// records still in RAM or in the flash queue show up on a later call
+bool journal_next(journal_cursor_t *cursor, journal_record_t *record);
+
+// Log offsets address the raw journal: segment seq * JOURNAL_SEGMENT_SIZE
+// plus the position in the segment. They only grow, so a reader can resume
+// at one across evictions and reboots. This is the range still there, up to
+// what is in flash; journal_flush() first to include everything.
+void journal_extent(uint32_t *start, uint32_t *end);
+
+// Copy raw journal bytes (headers, records and erased flash, as journal.c
+// lays them out) from a log offset, up to the end of its segment. Returns the
+// bytes copied, 0 past the end, LFS_ERR_NOENT if the segment was evicted.
+int journal_read_raw(uint32_t offset, void *buf, uint16_t len);
+
+void journal_get_stats(journal_stats_t *stats);
+
+// time spent inside journal_append(), flash work it had to wait for included
+lat_hist_t const *journal_append_latency(void);
+void journal_append_latency_reset(void);
+
+#endif /* JOURNAL_H_ */
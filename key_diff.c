@@ -0,0 +1,176 @@
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#include "key_diff.h"
+#include "event_ring.h"
+
+// Each keyboard interface keeps a 256-bit map of the usages it had down in its
+// previous report. A new report is turned into the same kind of map, and
+// changed = prev ^ now, pressed = changed & now, released = changed & prev are
+// done a word at a time, so the cost doesn't depend on how many keys a report
+// can carry (boot 6KRO or NKRO bitmaps alike). Only set bits are visited.
+
+#define MODIFIER_WORD (KEY_USAGE_MODIFIER_FIRST >> 5)
+
+// events are pushed in batches of this size
+#define KEY_DIFF_BATCH 16
+
+typedef struct {
+  uint8_t dev_addr;   // 0 = free
+  uint8_t instance;
+  key_bitmap_t prev;
+} key_diff_slot_t;
+
+static key_diff_slot_t slots[KEY_DIFF_SLOTS];
+static uint8_t const keycode2ascii[128][2] = { HID_KEYCODE_TO_ASCII };
+
+static key_diff_slot_t *find_slot(uint8_t dev_addr, uint8_t instance)
+{
+  key_diff_slot_t *free_slot = NULL;
+
+  for (uint8_t i = 0; i < KEY_DIFF_SLOTS; i++) {
+    key_diff_slot_t *s = &slots[i];
+    if (s->dev_addr == dev_addr && s->instance == instance) return s;
+    if (!free_slot && s->dev_addr == 0) free_slot = s;
+  }
+
+  if (free_slot) {
+    free_slot->dev_addr = dev_addr;
+    free_slot->instance = instance;
+    key_bitmap_clear(&free_slot->prev);
+  }
+  return free_slot;
+}
+
+bool key_bitmap_from_boot(key_bitmap_t *map, hid_keyboard_report_t const *report)
+{
+  // ErrorRollOver: too many keys down, the report says nothing about which
+  if (report->keycode[0] == 0x01) return false;
+
+  key_bitmap_clear(map);
+  map->w[MODIFIER_WORD] = report->modifier;
+
+  for (uint8_t i = 0; i < 6; i++) {
+    uint8_t keycode = report->keycode[i];
+    if (keycode) key_bitmap_set(map, keycode);
+  }
+
+  return true;
+}
+
+void key_bitmap_to_boot(key_bitmap_t const *map, hid_keyboard_report_t *report)
+{
+  memset(report, 0, sizeof(*report));
+  report->modifier = key_bitmap_modifier(map);
+
+  uint8_t n = 0;
+  for (uint8_t i = 0; i < MODIFIER_WORD; i++) {
+    uint32_t bits = map->w[i];
+    while (bits) {
+      if (n == 6) {
+        memset(report->keycode, 0x01, sizeof(report->keycode));
+        return;
+      }
+      report->keycode[n++] = (uint8_t) ((i << 5) | __builtin_ctz(bits));
+      bits &= bits - 1;
+    }
+  }
+}
+
+uint8_t key_usage_to_ascii(uint8_t usage, uint8_t modifier)
+{
+  bool const is_shift = modifier & (KEYBOARD_MODIFIER_LEFTSHIFT | KEYBOARD_MODIFIER_RIGHTSHIFT);
+  return usage < 128 ? keycode2ascii[usage][is_shift ? 1 : 0] : 0;
+}
+
+typedef struct {
+  input_event_t events[KEY_DIFF_BATCH];
+  uint32_t count;
+} event_batch_t;
+
+static void emit_word(event_batch_t *batch, input_event_t const *tmpl, uint8_t type,
+                      uint8_t word, uint32_t bits, bool is_shift)
+{
+  while (bits) {
+    uint8_t usage = (uint8_t) ((word << 5) | __builtin_ctz(bits));
+    bits &= bits - 1;
+
+    input_event_t *ev = &batch->events[batch->count++];
+    *ev = *tmpl;
+    ev->type = type;
+    ev->keycode = usage;
+    ev->ascii = usage < 128 ? keycode2ascii[usage][is_shift ? 1 : 0] : 0;
+
+    if (batch->count == KEY_DIFF_BATCH) {
+      event_ring_push(batch->events, batch->count);
+      batch->count = 0;
+    }
+  }
+}
+
+uint32_t key_diff_process(uint8_t dev_addr, uint8_t instance, key_bitmap_t const *now, uint32_t time_us)
+{
+  key_diff_slot_t *slot = find_slot(dev_addr, instance);
+  if (!slot) return 0;
+
+  uint8_t const modifier = key_bitmap_modifier(now);
+  bool const is_shift = modifier & (KEYBOARD_MODIFIER_LEFTSHIFT | KEYBOARD_MODIFIER_RIGHTSHIFT);
+
+  input_event_t const tmpl = {
+    .time_us = time_us,
+    .dev_addr = dev_addr,
+    .instance = instance,
+    .modifier = modifier,
+  };
+
+  uint32_t changed[KEY_BITMAP_WORDS];
+  uint32_t any = 0;
+  for (uint8_t i = 0; i < KEY_BITMAP_WORDS; i++) {
+    changed[i] = slot->prev.w[i] ^ now->w[i];
+    any |= changed[i];
+  }
+  if (!any) return 0;
+
+  event_batch_t batch;
+  batch.count = 0;
+  uint32_t transitions = 0;
+
+  // releases first, ordinary keys before modifiers
+  for (uint8_t i = 0; i < KEY_BITMAP_WORDS; i++) {
+    uint32_t released = changed[i] & slot->prev.w[i];
+    if (released) {
+      transitions += __builtin_popcount(released);
+      emit_word(&batch, &tmpl, EVENT_KEY_UP, i, released, is_shift);
+    }
+  }
+
+  // then presses, modifiers before ordinary keys so a shifted key reads right
+  for (uint8_t n = 0; n < KEY_BITMAP_WORDS; n++) {
+    uint8_t i = (uint8_t) ((MODIFIER_WORD + n) % KEY_BITMAP_WORDS);
+    uint32_t pressed = changed[i] & now->w[i];
+    if (pressed) {
+      transitions += __builtin_popcount(pressed);
+      emit_word(&batch, &tmpl, EVENT_KEY_DOWN, i, pressed, is_shift);
+    }
+  }
+
+  if (batch.count) event_ring_push(batch.events, batch.count);
+
+  slot->prev = *now;
+  return transitions;
+}
+
+void key_diff_release(uint8_t dev_addr, uint8_t instance)
+{
+  for (uint8_t i = 0; i < KEY_DIFF_SLOTS; i++) {
+    if (slots[i].dev_addr == dev_addr && slots[i].instance == instance) {
+      // whatever was still down goes up, so the log doesn't hold it forever
+      key_bitmap_t none;
+      key_bitmap_clear(&none);
+      key_diff_process(dev_addr, instance, &none, time_us_32());
+
+      slots[i].dev_addr = 0;
+    }
+  }
+}
@@ -0,0 +1,57 @@
+#ifndef KEY_DIFF_H_
+#define KEY_DIFF_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "tusb.h"
+
+// keyboards tracked at once, one per host HID interface
+#ifndef KEY_DIFF_SLOTS
+#define KEY_DIFF_SLOTS CFG_TUH_HID
+#endif
+
+#define KEY_BITMAP_WORDS 8
+
+// first usage of the modifier block (LeftControl), the modifier byte maps onto 0xE0-0xE7
+#define KEY_USAGE_MODIFIER_FIRST 0xE0
+
+// one bit per keyboard usage id, modifiers included
+typedef struct {
+  uint32_t w[KEY_BITMAP_WORDS];
+} key_bitmap_t;
+
+static inline void key_bitmap_clear(key_bitmap_t *map)
+{
+  for (uint8_t i = 0; i < KEY_BITMAP_WORDS; i++) map->w[i] = 0;
+}
+
+static inline void key_bitmap_set(key_bitmap_t *map, uint8_t usage)
+{
+  map->w[usage >> 5] |= 1u << (usage & 31);
+}
+
+static inline uint8_t key_bitmap_modifier(key_bitmap_t const *map)
+{
+  return (uint8_t) (map->w[KEY_USAGE_MODIFIER_FIRST >> 5] & 0xff);
+}
+
+// boot protocol report (modifier byte + 6 keycodes) to bitmap, false on ErrorRollOver
+bool key_bitmap_from_boot(key_bitmap_t *map, hid_keyboard_report_t const *report);
+
+// bitmap back to a boot report, more than 6 keys down reports ErrorRollOver
+void key_bitmap_to_boot(key_bitmap_t const *map, hid_keyboard_report_t *report);
+
+// Compare the new key state of (dev_addr, instance) with the previous one and
+// push a KEY_DOWN / KEY_UP event for every usage that changed into event_ring.
+// Returns the number of transitions found.
+uint32_t key_diff_process(uint8_t dev_addr, uint8_t instance, key_bitmap_t const *now, uint32_t time_us);
+
+// printable character of a usage with the given modifier byte, 0 if none
+uint8_t key_usage_to_ascii(uint8_t usage, uint8_t modifier);
+
+// an interface went away: push KEY_UP for every usage it still had down, then
+// forget its state
+void key_diff_release(uint8_t dev_addr, uint8_t instance);
+
+#endif /* KEY_DIFF_H_ */
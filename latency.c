@@ -0,0 +1,71 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "latency.h"
+
+static uint32_t bin_of(uint32_t us)
+{
+  if (us < LAT_HIST_SUB_BINS) return us;
+
+  uint32_t msb = 31 - __builtin_clz(us);
+  uint32_t sub = (us >> (msb - LAT_HIST_SUB_BITS)) & (LAT_HIST_SUB_BINS - 1);
+  return (msb - LAT_HIST_SUB_BITS + 1) * LAT_HIST_SUB_BINS + sub;
+}
+
+static uint32_t bin_upper(uint32_t bin)
+{
+  if (bin < LAT_HIST_SUB_BINS) return bin;
+
+  uint32_t msb = bin / LAT_HIST_SUB_BINS - 1 + LAT_HIST_SUB_BITS;
+  uint32_t sub = bin % LAT_HIST_SUB_BINS;
+  uint32_t shift = msb - LAT_HIST_SUB_BITS;
+  uint32_t lower = (LAT_HIST_SUB_BINS + sub) << shift;
+  return lower + ((1u << shift) - 1);
+}
+
+void lat_hist_reset(lat_hist_t *h)
+{
+  memset(h, 0, sizeof(*h));
+  h->min_us = UINT32_MAX;
+}
+
+void lat_hist_add(lat_hist_t *h, uint32_t us)
+{
+  h->count++;
+  h->sum_us += us;
+  if (us < h->min_us) h->min_us = us;
+  if (us > h->max_us) h->max_us = us;
+  h->bins[bin_of(us)]++;
+}
+
+uint32_t lat_hist_percentile(lat_hist_t const *h, uint32_t percent)
+{
+  if (!h->count) return 0;
+
+  // rank of the sample we're after, rounded up so p100 is the last one
+  uint32_t rank = (uint32_t) (((uint64_t) h->count * percent + 99) / 100);
+  if (rank == 0) rank = 1;
+
+  uint32_t seen = 0;
+  for (uint32_t b = 0; b < LAT_HIST_BINS; b++) {
+    seen += h->bins[b];
+    if (seen >= rank) {
+      uint32_t upper = bin_upper(b);
+      return upper > h->max_us ? h->max_us : upper;
+    }
+  }
+
+  return h->max_us;
+}
+
+int lat_hist_format(lat_hist_t const *h, char *buf, uint32_t size)
+{
+  if (!h->count) return snprintf(buf, size, "n=0\r\n");
+
+  return snprintf(buf, size, "n=%lu min=%lu p50=%lu p99=%lu max=%lu avg=%lu us\r\n",
+                  (unsigned long) h->count, (unsigned long) h->min_us,
+                  (unsigned long) lat_hist_percentile(h, 50),
+                  (unsigned long) lat_hist_percentile(h, 99),
+                  (unsigned long) h->max_us,
+                  (unsigned long) (h->sum_us / h->count));
+}
@@ -0,0 +1,31 @@
+#ifndef LATENCY_H_
+#define LATENCY_H_
+
+#include <stdint.h>
+
+// Log-scale histogram of microsecond samples. Every power of two is split into
+// LAT_HIST_SUB_BINS bins, so the error of a reported percentile stays within
+// 1/LAT_HIST_SUB_BINS of the value no matter how large it is.
+
+#define LAT_HIST_SUB_BITS 3
+#define LAT_HIST_SUB_BINS (1u << LAT_HIST_SUB_BITS)
+#define LAT_HIST_BINS     (32 * LAT_HIST_SUB_BINS)
+
+typedef struct {
+  uint32_t count;
+  uint32_t min_us;
+  uint32_t max_us;
+  uint64_t sum_us;
+  uint32_t bins[LAT_HIST_BINS];
+} lat_hist_t;
+
+void lat_hist_reset(lat_hist_t *h);
+void lat_hist_add(lat_hist_t *h, uint32_t us);
+
+// upper bound of the bin holding the given percentile (0-100), 0 if empty
+uint32_t lat_hist_percentile(lat_hist_t const *h, uint32_t percent);
+
+// "n min p50 p99 max" on one line, returns the length written
+int lat_hist_format(lat_hist_t const *h, char *buf, uint32_t size);
+
+#endif /* LATENCY_H_ */
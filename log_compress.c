@@ -0,0 +1,154 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "log_compress.h"
+
+#define MIN_MATCH  3
+#define MAX_MATCH  (MIN_MATCH + 15)
+#define MAX_DIST   4095
+#define MAX_CHAIN  16
+#define HASH_SIZE  256
+
+// Seeds every block. Matches are cheaper the more of a block they cover, so
+// this favours what keyboards produce most: frequent English words with their
+// spaces, word endings, and things typed at login prompts and in shells.
+static const char dict[] =
+  "https://www. http:// .com .org .net @gmail.com @outlook.com password Password "
+  "username login admin root sudo cd .. ls -la git commit -m git push git pull "
+  "Hello Thanks Regards Best regards Dear Please "
+  "the and that have for not with you this but his from they say her she will "
+  "one all would there their what out about who get which when make can like "
+  "time just him know take people into year your good some could them see other "
+  "than then now look only come its over think also back after use two how our "
+  "work first well way even new want because any these give day most us is are "
+  "was were been has had do does did tion ing ment ness able ould ight ough "
+  "The I'm I'll don't can't it's that's ";
+
+#define DICT_LEN ((uint16_t) (sizeof(dict) - 1))
+
+static_assert(DICT_LEN + LOG_COMPRESS_BLOCK_MAX <= MAX_DIST, "distances must fit 12 bits");
+
+// dictionary followed by the block being compressed
+static uint8_t window[DICT_LEN + LOG_COMPRESS_BLOCK_MAX];
+static int16_t head[HASH_SIZE];
+static int16_t prev[DICT_LEN + LOG_COMPRESS_BLOCK_MAX];
+
+// chains through the dictionary never change, they are built once
+static int16_t dict_head[HASH_SIZE];
+static bool dict_ready = false;
+
+static uint8_t hash3(uint8_t const *p)
+{
+  return (uint8_t) ((p[0] * 33u + p[1]) * 33u + p[2]);
+}
+
+static void insert(uint16_t pos)
+{
+  uint8_t h = hash3(&window[pos]);
+  prev[pos] = head[h];
+  head[h] = (int16_t) pos;
+}
+
+static void dict_init(void)
+{
+  memcpy(window, dict, DICT_LEN);
+  memset(head, 0xFF, sizeof(head));
+  for (uint16_t i = 0; i + MIN_MATCH <= DICT_LEN; i++) insert(i);
+  memcpy(dict_head, head, sizeof(head));
+  dict_ready = true;
+}
+
+uint16_t log_compress(uint8_t const *in, uint16_t len, uint8_t *out, uint16_t cap)
+{
+  if (len == 0 || len > LOG_COMPRESS_BLOCK_MAX) return 0;
+  if (!dict_ready) dict_init();
+
+  memcpy(&window[DICT_LEN], in, len);
+  memcpy(head, dict_head, sizeof(head));
+
+  uint16_t const end = DICT_LEN + len;
+  uint16_t pos = DICT_LEN;
+  uint16_t n = 0;
+  uint16_t flag_at = 0;
+  uint8_t item = 8;
+
+  while (pos < end) {
+    if (item == 8) {
+      if (n >= cap) return 0;
+      flag_at = n;
+      out[n++] = 0;
+      item = 0;
+    }
+
+    // longest earlier match, newest first
+    uint16_t best_len = 0;
+    uint16_t best_dist = 0;
+    uint16_t limit = end - pos < MAX_MATCH ? end - pos : MAX_MATCH;
+
+    if (limit >= MIN_MATCH) {
+      int16_t cand = head[hash3(&window[pos])];
+      for (uint8_t depth = 0; cand >= 0 && depth < MAX_CHAIN; depth++) {
+        uint16_t l = 0;
+        while (l < limit && window[cand + l] == window[pos + l]) l++;
+        if (l > best_len) {
+          best_len = l;
+          best_dist = (uint16_t) (pos - cand);
+          if (l == limit) break;
+        }
+        cand = prev[cand];
+      }
+    }
+
+    if (best_len >= MIN_MATCH) {
+      if (n + 2 > cap) return 0;
+      out[flag_at] |= (uint8_t) (1u << item);
+      out[n++] = (uint8_t) (((best_len - MIN_MATCH) << 4) | (best_dist >> 8));
+      out[n++] = (uint8_t) best_dist;
+    } else {
+      best_len = 1;
+      if (n + 1 > cap) return 0;
+      out[n++] = window[pos];
+    }
+
+    for (uint16_t i = 0; i < best_len; i++, pos++) {
+      if (pos + MIN_MATCH <= end) insert(pos);
+    }
+    item++;
+  }
+
+  return n;
+}
+
+uint16_t log_decompress(uint8_t const *in, uint16_t len, uint8_t *out, uint16_t cap)
+{
+  uint16_t n = 0;
+  uint16_t i = 0;
+
+  while (i < len) {
+    uint8_t flags = in[i++];
+
+    for (uint8_t item = 0; item < 8 && i < len; item++) {
+      if (!(flags & (1u << item))) {
+        if (n >= cap) return 0;
+        out[n++] = in[i++];
+        continue;
+      }
+
+      if (i + 2 > len) return 0;
+      uint16_t l = (uint16_t) ((in[i] >> 4) + MIN_MATCH);
+      uint16_t dist = (uint16_t) (((in[i] & 0x0F) << 8) | in[i + 1]);
+      i += 2;
+
+      // position in dictionary + output
+      uint16_t at = DICT_LEN + n;
+      if (dist == 0 || dist > at || n + l > cap) return 0;
+
+      for (uint16_t src = at - dist; l; l--, src++) {
+        out[n++] = src < DICT_LEN ? (uint8_t) dict[src] : out[src - DICT_LEN];
+      }
+    }
+  }
+
+  return n;
+}
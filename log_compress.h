@@ -0,0 +1,26 @@
+#ifndef LOG_COMPRESS_H_
+#define LOG_COMPRESS_H_
+
+#include <stdint.h>
+
+// Small LZ77 block compressor for logged text. Every block is compressed on
+// its own against a fixed dictionary of common words and typing fragments, so
+// any block can be decompressed without the ones before it and without
+// buffering more than one block.
+//
+// Block: groups of a flag byte followed by 8 items (fewer at the end). Flag
+// bit n (LSB first) set means item n is a match, 2 bytes: length - 3 in the
+// top 4 bits, then a 12-bit distance back into dictionary + output so far.
+// A clear bit means one literal byte.
+
+// largest block, in uncompressed bytes
+#define LOG_COMPRESS_BLOCK_MAX 256
+
+// compress len bytes into out, returns the compressed length, or 0 if it
+// doesn't fit in cap (store the block raw then)
+uint16_t log_compress(uint8_t const *in, uint16_t len, uint8_t *out, uint16_t cap);
+
+// returns the decompressed length, 0 if the block is damaged or doesn't fit in cap
+uint16_t log_decompress(uint8_t const *in, uint16_t len, uint8_t *out, uint16_t cap);
+
+#endif /* LOG_COMPRESS_H_ */
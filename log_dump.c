@@ -0,0 +1,202 @@
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "tusb.h"
+
+#include "journal.h"
+#include "log_tail.h"
+#include "log_writer.h"
+#include "log_dump.h"
+
+enum {
+  SOURCE_NONE = 0,
+  SOURCE_JOURNAL,
+  SOURCE_TAIL,
+  SOURCE_STAGED,    // the block still being staged, after the tail cache
+  SOURCE_TRAILER,
+};
+
+static char const trailer[] = "\r\nDone\r\n";
+
+static uint8_t source = SOURCE_NONE;
+static bool ranged;
+static uint32_t range_from_ms;
+static uint32_t range_to_ms;
+static journal_cursor_t journal_cursor;
+static log_tail_cursor_t tail_cursor;
+
+// text of the current record, waiting for room in the FIFO
+static uint8_t text[LOG_WRITER_STAGE_SIZE];
+static uint8_t const *out;
+static uint16_t out_len;
+
+static uint32_t start_us;
+static log_dump_stats_t stats;
+
+// text of one record into the out buffer, false once the range is over
+static bool record_text(journal_record_t const *rec)
+{
+  uint16_t len = 0;
+  bool more = true;
+
+  stats.records++;
+
+  if (ranged) {
+    more = log_writer_range_text(rec, range_from_ms, range_to_ms, text, &len);
+  } else {
+    uint8_t const *p = log_writer_record_text(rec, text, &len);
+    if (!p) {
+      len = 0;
+    } else if (p != text) {
+      // plain text points into flash or the cache, either may be reused
+      // before the FIFO takes all of it
+      memcpy(text, p, len);
+    }
+  }
+
+  out = text;
+  out_len = len;
+  return more;
+}
+
+static void next_chunk(void)
+{
+  journal_record_t rec;
+
+  switch (source) {
+    case SOURCE_JOURNAL:
+      if (!journal_next(&journal_cursor, &rec) || !record_text(&rec)) source = SOURCE_TRAILER;
+      break;
+
+    case SOURCE_TAIL:
+      if (!log_tail_next(&tail_cursor, &rec)) {
+        source = SOURCE_STAGED;
+      } else if (!record_text(&rec)) {
+        source = SOURCE_TRAILER;
+      }
+      break;
+
+    case SOURCE_STAGED:
+      source = SOURCE_TRAILER;
+      if (log_writer_staged(&rec)) record_text(&rec);
+      break;
+
+    case SOURCE_TRAILER:
+      out = (uint8_t const *) trailer;
+      out_len = sizeof(trailer) - 1;
+      source = SOURCE_NONE;
+      break;
+
+    default:
+      break;
+  }
+}
+
+static void finish(void)
+{
+  stats.elapsed_us = time_us_32() - start_us;
+  stats.active = false;
+  source = SOURCE_NONE;
+  out_len = 0;
+  tud_cdc_write_flush();
+}
+
+static bool start(void)
+{
+  if (source != SOURCE_NONE || out_len) return false;
+
+  memset(&stats, 0, sizeof(stats));
+  stats.active = true;
+  start_us = time_us_32();
+  return true;
+}
+
+bool log_dump_start_all(void)
+{
+  if (!start()) return false;
+
+  ranged = false;
+  journal_rewind(&journal_cursor);
+  source = SOURCE_JOURNAL;
+  return true;
+}
+
+bool log_dump_start_range(uint32_t from_ms, uint32_t to_ms)
+{
+  if (!start()) return false;
+
+  ranged = true;
+  range_from_ms = from_ms;
+  range_to_ms = to_ms;
+
+  // recent ranges come from the SRAM tail cache and the stage, no flash reads
+  if (log_tail_seek(&tail_cursor, from_ms)) {
+    stats.from_cache = true;
+    source = SOURCE_TAIL;
+    return true;
+  }
+
+  // records are committed up to LOG_WRITER_MAX_AGE_MS after their events
+  uint32_t const slack = LOG_WRITER_MAX_AGE_MS + 1000;
+  journal_seek(&journal_cursor, from_ms > slack ? from_ms - slack : 0);
+  source = SOURCE_JOURNAL;
+  return true;
+}
+
+void log_dump_cancel(void)
+{
+  if (!stats.active) return;
+
+  stats.aborted = true;
+  finish();
+}
+
+bool log_dump_active(void)
+{
+  return stats.active;
+}
+
+void log_dump_task(void)
+{
+  if (!stats.active) return;
+
+  // nobody reading any more, the FIFO would stay full for good
+  if (!tud_cdc_connected()) {
+    stats.aborted = true;
+    finish();
+    return;
+  }
+
+  uint16_t records = 0;
+
+  for (;;) {
+    while (!out_len) {
+      if (source == SOURCE_NONE) {
+        finish();
+        return;
+      }
+      // leave the rest of the loop some time when records turn out empty
+      if (records++ == LOG_DUMP_RECORDS_PER_TASK) return;
+      next_chunk();
+    }
+
+    uint32_t room = tud_cdc_write_available();
+    if (!room) {
+      // come back once tud_task() has moved the FIFO into the endpoint
+      stats.fifo_full++;
+      tud_cdc_write_flush();
+      return;
+    }
+
+    uint32_t n = tud_cdc_write(out, out_len < room ? out_len : room);
+    out += n;
+    out_len = (uint16_t) (out_len - n);
+    stats.bytes += n;
+  }
+}
+
+void log_dump_get_stats(log_dump_stats_t *out_stats)
+{
+  *out_stats = stats;
+  if (stats.active) out_stats->elapsed_us = time_us_32() - start_us;
+}
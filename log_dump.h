@@ -0,0 +1,47 @@
+#ifndef LOG_DUMP_H_
+#define LOG_DUMP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Streams the log out of the CDC port from the core0 loop. Each call to
+// log_dump_task() gives the TX FIFO as much as it has room for and returns
+// once it is full, so tud_task() and HID forwarding keep running while a
+// dump goes out and nothing is written into a full FIFO (and dropped).
+//
+// The journal part goes as far as what is in flash when the dump gets there;
+// commit and let flash_sched drain its queue first to include everything.
+
+// records turned into text per log_dump_task() call at most
+#ifndef LOG_DUMP_RECORDS_PER_TASK
+#define LOG_DUMP_RECORDS_PER_TASK 16
+#endif
+
+typedef struct {
+  uint32_t bytes;         // sent by the last (or running) dump, trailer included
+  uint32_t records;
+  uint32_t elapsed_us;
+  uint32_t fifo_full;     // times the dump gave way to a full TX FIFO
+  bool active;
+  bool from_cache;        // served from the SRAM tail cache
+  bool aborted;           // cancelled, or the terminal went away before the end
+} log_dump_stats_t;
+
+// the whole log, false if a dump is already running
+bool log_dump_start_all(void);
+
+// text typed between from_ms and to_ms (journal clock), false if a dump is
+// already running
+bool log_dump_start_range(uint32_t from_ms, uint32_t to_ms);
+
+// stop the running dump where it is
+void log_dump_cancel(void);
+
+bool log_dump_active(void);
+
+// move the running dump along, call from the core0 loop
+void log_dump_task(void);
+
+void log_dump_get_stats(log_dump_stats_t *stats);
+
+#endif /* LOG_DUMP_H_ */
@@ -0,0 +1,161 @@
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "tusb.h"
+
+#include "event_log.h"
+#include "journal.h"
+#include "key_diff.h"
+#include "log_live.h"
+
+#define RING_MASK (LOG_LIVE_RING_SIZE - 1)
+#define FRAME_US  1000
+
+// longest text for one event, "<Mxx>"
+#define TEXT_MAX 5
+
+static_assert((LOG_LIVE_RING_SIZE & RING_MASK) == 0, "ring size must be a power of two");
+
+static bool active = false;
+static uint8_t format;
+static input_event_t ring[LOG_LIVE_RING_SIZE];
+static uint32_t head;
+static uint32_t tail;
+static uint32_t last_packet_us;
+static uint32_t start_us;
+static log_live_stats_t stats;
+
+void log_live_start(uint8_t fmt)
+{
+  memset(&stats, 0, sizeof(stats));
+  format = fmt;
+  head = tail = 0;
+  start_us = time_us_32();
+  last_packet_us = start_us - FRAME_US;
+  active = true;
+}
+
+void log_live_stop(void)
+{
+  if (!active) return;
+
+  stats.elapsed_us = time_us_32() - start_us;
+  active = false;
+}
+
+bool log_live_active(void)
+{
+  return active;
+}
+
+void log_live_event(input_event_t const *event)
+{
+  if (!active) return;
+
+  stats.events++;
+  if (head - tail == LOG_LIVE_RING_SIZE) {
+    stats.dropped++;
+    return;
+  }
+  ring[head & RING_MASK] = *event;
+  head++;
+}
+
+static uint16_t event_text(input_event_t const *ev, char *out)
+{
+  if (ev->type == EVENT_MOUSE_BUTTONS) return (uint16_t) sprintf(out, "<M%X>", ev->keycode);
+  if (ev->type != EVENT_KEY_DOWN || ev->keycode >= KEY_USAGE_MODIFIER_FIRST) return 0;
+
+  if (ev->ascii == '\n' || ev->ascii == '\r') {
+    out[0] = '\r';
+    out[1] = '\n';
+    return 2;
+  }
+  if (ev->ascii >= ' ' && ev->ascii < 0x7F) {
+    out[0] = (char) ev->ascii;
+    return 1;
+  }
+  return (uint16_t) sprintf(out, "<%02X>", ev->keycode);
+}
+
+// as many waiting events as fit one packet, returns its length
+static uint16_t pack_text(uint8_t *pkt)
+{
+  uint16_t len = 0;
+  char text[TEXT_MAX + 1];
+
+  while (tail != head) {
+    uint16_t n = event_text(&ring[tail & RING_MASK], text);
+    if (len + n > LOG_LIVE_PACKET_SIZE) break;
+
+    memcpy(&pkt[len], text, n);
+    len = (uint16_t) (len + n);
+    tail++;
+  }
+  return len;
+}
+
+static uint16_t pack_binary(uint8_t *pkt)
+{
+  input_event_t const *first = &ring[tail & RING_MASK];
+
+  // core1 stamped in microseconds, the log counts in journal clock ms
+  uint32_t const now_us = time_us_32();
+  uint32_t const now_ms = journal_time_ms();
+
+  event_log_writer_t w;
+  if (!event_log_begin(&w, &pkt[1], LOG_LIVE_PACKET_SIZE - 1, now_ms - (now_us - first->time_us) / 1000,
+                       first->dev_addr, first->instance, first->modifier)) {
+    return 0;
+  }
+
+  while (tail != head) {
+    input_event_t const *e = &ring[tail & RING_MASK];
+    event_log_event_t const ev = {
+      .time_ms = now_ms - (now_us - e->time_us) / 1000,
+      .type = e->type,
+      .dev_addr = e->dev_addr,
+      .instance = e->instance,
+      .code = e->keycode,
+    };
+    if (!event_log_put(&w, &ev)) break;
+    tail++;
+  }
+
+  pkt[0] = (uint8_t) w.len;
+  return (uint16_t) (w.len + 1);
+}
+
+void log_live_task(void)
+{
+  if (!active || tail == head) return;
+
+  uint32_t const start = time_us_32();
+
+  // one packet per frame at most, and only whole packets
+  if (start - last_packet_us < FRAME_US) return;
+  if (tud_cdc_write_available() < LOG_LIVE_PACKET_SIZE) {
+    stats.held_back++;
+    return;
+  }
+
+  uint8_t pkt[LOG_LIVE_PACKET_SIZE];
+  uint16_t len = format == LOG_LIVE_BINARY ? pack_binary(pkt) : pack_text(pkt);
+
+  if (len) {
+    tud_cdc_write(pkt, len);
+    tud_cdc_write_flush();
+    stats.packets++;
+    stats.bytes += len;
+  }
+  last_packet_us = start;
+  stats.busy_us += time_us_32() - start;
+}
+
+void log_live_get_stats(log_live_stats_t *out)
+{
+  *out = stats;
+  if (active) out->elapsed_us = time_us_32() - start_us;
+}
@@ -0,0 +1,55 @@
+#ifndef LOG_LIVE_H_
+#define LOG_LIVE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "event_ring.h"
+
+// Live view of the input being logged ("tail"), streamed over CDC. Events
+// wait in a small ring and go out at most one packet per USB frame; while the
+// TX FIFO has no room they keep waiting, and once the ring is full the newest
+// are dropped and counted.
+//
+// Text: characters as typed, <xx> for a key without one (HID usage in hex),
+// <Mx> for a change of mouse buttons.
+// Binary: a length byte, then one event_log.h block of that length, per packet.
+
+// events waiting to go out, a power of two
+#ifndef LOG_LIVE_RING_SIZE
+#define LOG_LIVE_RING_SIZE 64
+#endif
+
+// bytes per packet, one full-speed bulk packet
+#ifndef LOG_LIVE_PACKET_SIZE
+#define LOG_LIVE_PACKET_SIZE 64
+#endif
+
+enum {
+  LOG_LIVE_TEXT = 0,
+  LOG_LIVE_BINARY,
+};
+
+typedef struct {
+  uint32_t events;
+  uint32_t dropped;       // ring full, the host wasn't reading fast enough
+  uint32_t packets;
+  uint32_t bytes;
+  uint32_t held_back;     // frames skipped for lack of FIFO room
+  uint32_t busy_us;       // core0 time spent on the live view
+  uint32_t elapsed_us;
+} log_live_stats_t;
+
+void log_live_start(uint8_t format);
+void log_live_stop(void);
+bool log_live_active(void);
+
+// an event core1 handed over, cheap when the live view is off
+void log_live_event(input_event_t const *event);
+
+// send a packet if a frame has passed and there is room, call from the core0 loop
+void log_live_task(void);
+
+void log_live_get_stats(log_live_stats_t *stats);
+
+#endif /* LOG_LIVE_H_ */
@@ -0,0 +1,443 @@
+#include <assert.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "tusb.h"
+
+#include "flash_sched.h"
+#include "journal.h"
+#include "log_writer.h"
+#include "log_proto.h"
+
+#define CRC_LEN 4
+
+// 'D' + offset + length + data + CRC, COBS adds a byte per 254 and the 0x00
+#define FRAME_MAX     (1 + 4 + 2 + LOG_PROTO_CHUNK_SIZE + CRC_LEN)
+#define FRAME_MAX_ENC (FRAME_MAX + FRAME_MAX / 254 + 2)
+
+// longest frame a host sends is 'R'
+#define RX_MAX 32
+
+static_assert(JOURNAL_SEGMENT_SIZE % LOG_PROTO_CHUNK_SIZE == 0, "chunks must not cross segments");
+static_assert(LOG_PROTO_WINDOW_MAX <= 255, "window is a byte on the wire");
+
+static bool active = false;
+static uint32_t last_rx_ms;
+static log_proto_stats_t stats;
+
+static uint8_t rx[RX_MAX];
+static uint16_t rx_len;
+static bool rx_overflow;        // drop the frame being received
+
+// the transfer: [acked, next) is in flight, [next, end) still to send
+static bool xfer = false;
+static uint32_t xfer_end;
+static uint32_t acked;
+static uint32_t next;
+static uint8_t window;
+static uint32_t ack_ms;         // when acked last moved or was sent again
+static uint32_t resend[LOG_PROTO_WINDOW_MAX];
+static uint8_t resend_count;
+
+// an 'I' or 'R' waiting for the log to reach flash, 0 if none
+static uint8_t pending;
+static uint32_t pending_offset;
+static uint32_t pending_length;
+static uint8_t pending_window;
+
+// a control frame waiting to go out before any chunk
+static uint8_t reply[16];
+static uint16_t reply_len;
+
+static uint8_t tx[FRAME_MAX_ENC];
+static uint16_t tx_pos;
+static uint16_t tx_len;
+
+static uint32_t now_ms(void)
+{
+  return to_ms_since_boot(get_absolute_time());
+}
+
+static uint32_t crc32(uint32_t crc, void const *data, uint32_t len)
+{
+  static uint32_t const table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+  };
+  uint8_t const *p = data;
+
+  crc = ~crc;
+  while (len--) {
+    crc ^= *p++;
+    crc = (crc >> 4) ^ table[crc & 15];
+    crc = (crc >> 4) ^ table[crc & 15];
+  }
+  return ~crc;
+}
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+  p[0] = (uint8_t) v;
+  p[1] = (uint8_t) (v >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+  put_u16(p, (uint16_t) v);
+  put_u16(p + 2, (uint16_t) (v >> 16));
+}
+
+static uint32_t get_u32(uint8_t const *p)
+{
+  return p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+}
+
+//--------------------------------------------------------------------+
+// Framing
+//--------------------------------------------------------------------+
+
+// COBS encode len bytes and the closing 0x00, returns the encoded length
+static uint16_t cobs_encode(uint8_t const *in, uint16_t len, uint8_t *out)
+{
+  uint16_t code_at = 0;
+  uint16_t o = 1;
+  uint8_t code = 1;
+
+  for (uint16_t i = 0; i < len; i++) {
+    if (in[i]) {
+      out[o++] = in[i];
+      code++;
+    }
+    if (!in[i] || code == 0xFF) {
+      out[code_at] = code;
+      code_at = o++;
+      code = 1;
+    }
+  }
+  out[code_at] = code;
+  out[o++] = 0;
+  return o;
+}
+
+// decode in place, the result is never longer; -1 if it isn't valid COBS
+static int32_t cobs_decode(uint8_t *buf, uint16_t len)
+{
+  uint16_t i = 0;
+  uint16_t o = 0;
+
+  while (i < len) {
+    uint8_t code = buf[i++];
+    if (code == 0 || i + code - 1 > len) return -1;
+
+    for (uint8_t k = 1; k < code; k++) buf[o++] = buf[i++];
+    if (code < 0xFF && i < len) buf[o++] = 0;
+  }
+  return o;
+}
+
+// frame of len bytes in f (room for the CRC after them) into the tx buffer
+static void send_frame(uint8_t *f, uint16_t len)
+{
+  put_u32(&f[len], crc32(0, f, len));
+  tx_len = cobs_encode(f, (uint16_t) (len + CRC_LEN), tx);
+  tx_pos = 0;
+}
+
+static void queue_reply_end(uint8_t code, uint32_t offset)
+{
+  reply[0] = 'E';
+  reply[1] = code;
+  put_u32(&reply[2], offset);
+  reply_len = 6;
+  xfer = false;
+}
+
+//--------------------------------------------------------------------+
+// Requests
+//--------------------------------------------------------------------+
+
+static void handle_info(void)
+{
+  uint32_t start, end;
+  journal_extent(&start, &end);
+
+  reply[0] = 'I';
+  put_u32(&reply[1], start);
+  put_u32(&reply[5], end);
+  put_u16(&reply[9], LOG_PROTO_CHUNK_SIZE);
+  reply_len = 11;
+}
+
+static void handle_read(uint32_t offset, uint32_t length, uint8_t win)
+{
+  uint32_t start, end;
+  journal_extent(&start, &end);
+
+  if (win == 0 || win > LOG_PROTO_WINDOW_MAX) {
+    queue_reply_end(LOG_PROTO_BAD_REQUEST, offset);
+    return;
+  }
+  if (offset < start) {
+    queue_reply_end(LOG_PROTO_GONE, start);
+    return;
+  }
+  if (offset >= end) {
+    queue_reply_end(LOG_PROTO_DONE, offset);
+    return;
+  }
+
+  xfer = true;
+  xfer_end = length < end - offset ? offset + length : end;
+  acked = offset;
+  next = offset;
+  window = win;
+  resend_count = 0;
+  ack_ms = now_ms();
+}
+
+static void handle_ack(uint32_t offset)
+{
+  if (!xfer || offset <= acked || offset > next) return;
+
+  acked = offset;
+  ack_ms = now_ms();
+
+  // resends of chunks that arrived after all
+  uint8_t kept = 0;
+  for (uint8_t i = 0; i < resend_count; i++) {
+    if (resend[i] >= acked) resend[kept++] = resend[i];
+  }
+  resend_count = kept;
+}
+
+static void queue_resend(uint32_t offset)
+{
+  if (!xfer || offset < acked || offset >= next) return;
+
+  for (uint8_t i = 0; i < resend_count; i++) {
+    if (resend[i] == offset) return;
+  }
+  if (resend_count < LOG_PROTO_WINDOW_MAX) resend[resend_count++] = offset;
+}
+
+// Staged bytes belong in the answer. Flushing here, inside tud_task(), would
+// run every queued program and erase at once, so the stage is only committed
+// and the answer goes out from log_proto_task() once flash_sched has it all
+// in flash.
+static void defer(uint8_t type, uint32_t offset, uint32_t length, uint8_t win)
+{
+  log_writer_commit();
+
+  pending = type;
+  pending_offset = offset;
+  pending_length = length;
+  pending_window = win;
+}
+
+static void handle_pending(void)
+{
+  if (!pending) return;
+
+  flash_sched_stats_t fs;
+  flash_sched_get_stats(&fs);
+  if (fs.queued) return;
+
+  if (pending == 'I') {
+    handle_info();
+  } else {
+    handle_read(pending_offset, pending_length, pending_window);
+  }
+  pending = 0;
+}
+
+static void handle_frame(uint8_t *f, int32_t len)
+{
+  if (len < 1 + CRC_LEN || get_u32(&f[len - CRC_LEN]) != crc32(0, f, (uint32_t) (len - CRC_LEN))) {
+    stats.frames_bad++;
+    return;
+  }
+
+  stats.frames_in++;
+  last_rx_ms = now_ms();
+  len -= CRC_LEN;
+
+  switch (f[0]) {
+    case 'I':
+      if (len != 1) break;
+      defer('I', 0, 0, 0);
+      return;
+
+    case 'R':
+      if (len != 10) break;
+      defer('R', get_u32(&f[1]), get_u32(&f[5]), f[9]);
+      return;
+
+    case 'A':
+      if (len != 5) break;
+      handle_ack(get_u32(&f[1]));
+      return;
+
+    case 'N':
+      if (len != 5) break;
+      queue_resend(get_u32(&f[1]));
+      return;
+
+    case 'Q':
+      if (len != 1) break;
+      active = false;
+      xfer = false;
+      pending = 0;
+      return;
+
+    default:
+      break;
+  }
+
+  queue_reply_end(LOG_PROTO_BAD_REQUEST, 0);
+}
+
+void log_proto_rx(uint8_t const *data, uint32_t len)
+{
+  for (uint32_t i = 0; i < len && active; i++) {
+    if (data[i] != 0) {
+      if (rx_len < sizeof(rx)) {
+        rx[rx_len++] = data[i];
+      } else {
+        rx_overflow = true;
+      }
+      continue;
+    }
+
+    if (rx_overflow) {
+      stats.frames_bad++;
+    } else if (rx_len) {
+      handle_frame(rx, cobs_decode(rx, rx_len));
+    }
+    rx_len = 0;
+    rx_overflow = false;
+  }
+}
+
+//--------------------------------------------------------------------+
+// Sending
+//--------------------------------------------------------------------+
+
+// the chunk at offset into the tx buffer, false if it couldn't be read
+static bool send_chunk(uint32_t offset)
+{
+  static uint8_t f[FRAME_MAX];
+
+  uint32_t len = LOG_PROTO_CHUNK_SIZE - offset % LOG_PROTO_CHUNK_SIZE;
+  if (len > xfer_end - offset) len = xfer_end - offset;
+
+  int n = journal_read_raw(offset, &f[7], (uint16_t) len);
+  if (n < 0) {
+    uint32_t start, end;
+    journal_extent(&start, &end);
+    queue_reply_end(LOG_PROTO_GONE, start);
+    return false;
+  }
+
+  f[0] = 'D';
+  put_u32(&f[1], offset);
+  put_u16(&f[5], (uint16_t) n);
+  send_frame(f, (uint16_t) (7 + n));
+
+  stats.bytes_sent += (uint32_t) n;
+  return true;
+}
+
+// pick the next frame to send, false if there is none
+static bool next_frame(void)
+{
+  if (reply_len) {
+    static uint8_t f[sizeof(reply) + CRC_LEN];
+    memcpy(f, reply, reply_len);
+    send_frame(f, reply_len);
+    reply_len = 0;
+    return true;
+  }
+
+  if (!xfer) return false;
+
+  if (acked >= xfer_end) {
+    queue_reply_end(LOG_PROTO_DONE, xfer_end);
+    return next_frame();
+  }
+
+  uint32_t const now = now_ms();
+  if (acked < next && now - ack_ms >= LOG_PROTO_RETRY_MS) {
+    // nothing heard back, the oldest chunk may be lost
+    queue_resend(acked);
+    ack_ms = now;
+  }
+
+  if (resend_count) {
+    uint32_t offset = resend[0];
+    memmove(&resend[0], &resend[1], --resend_count * sizeof(resend[0]));
+    stats.chunks_resent++;
+    return send_chunk(offset) || next_frame();
+  }
+
+  if (next < xfer_end && next - acked < (uint32_t) window * LOG_PROTO_CHUNK_SIZE) {
+    uint32_t offset = next;
+    next += LOG_PROTO_CHUNK_SIZE - next % LOG_PROTO_CHUNK_SIZE;
+    if (next > xfer_end) next = xfer_end;
+    stats.chunks_sent++;
+    return send_chunk(offset) || next_frame();
+  }
+
+  return false;
+}
+
+void log_proto_task(void)
+{
+  if (!active) return;
+
+  if (!tud_cdc_connected() || now_ms() - last_rx_ms >= LOG_PROTO_IDLE_MS) {
+    active = false;
+    xfer = false;
+    pending = 0;
+    return;
+  }
+
+  handle_pending();
+
+  for (;;) {
+    if (tx_pos == tx_len && !next_frame()) break;
+
+    uint32_t room = tud_cdc_write_available();
+    if (!room) break;
+
+    uint32_t left = (uint32_t) (tx_len - tx_pos);
+    uint32_t n = tud_cdc_write(&tx[tx_pos], left < room ? left : room);
+    tx_pos = (uint16_t) (tx_pos + n);
+  }
+  tud_cdc_write_flush();
+}
+
+//--------------------------------------------------------------------+
+// Mode
+//--------------------------------------------------------------------+
+
+void log_proto_enter(void)
+{
+  active = true;
+  xfer = false;
+  pending = 0;
+  rx_len = 0;
+  rx_overflow = false;
+  reply_len = 0;
+  tx_pos = tx_len = 0;
+  last_rx_ms = now_ms();
+}
+
+bool log_proto_active(void)
+{
+  return active;
+}
+
+void log_proto_get_stats(log_proto_stats_t *out)
+{
+  *out = stats;
+}
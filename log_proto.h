@@ -0,0 +1,81 @@
+#ifndef LOG_PROTO_H_
+#define LOG_PROTO_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Binary retrieval protocol on the CDC port, entered with the `binary`
+// command. Frames are COBS encoded and end with a 0x00 byte. Decoded, a frame
+// is a type byte, its fields (little endian) and a CRC32 (IEEE, as in zlib)
+// of everything before it. Frames that fail the CRC are dropped.
+//
+// Host to device:
+//   'I'                                      where the log starts and ends
+//   'R' <offset u32> <length u32> <window u8>
+//                                            read length bytes from offset,
+//                                            with up to window chunks in flight
+//   'A' <offset u32>                         everything below offset arrived
+//   'N' <offset u32>                         send the chunk at offset again
+//   'Q'                                      back to the command line
+//
+// Device to host:
+//   'I' <start u32> <end u32> <chunk u16>    log offsets that can be read
+//   'D' <offset u32> <length u16> <data>     one chunk, never crossing a
+//                                            multiple of the chunk size
+//   'E' <code u8> <offset u32>               transfer over, see below
+//
+// Offsets are journal log offsets (journal_extent()), the data is the raw
+// segments, laid out as described in journal.c. A chunk that isn't
+// acknowledged in time is sent again, on its own. 'I' and 'R' are answered
+// once what was staged when they came in is in flash, which can take until
+// typing pauses.
+
+// data bytes per chunk, divides JOURNAL_SEGMENT_SIZE
+#ifndef LOG_PROTO_CHUNK_SIZE
+#define LOG_PROTO_CHUNK_SIZE 256
+#endif
+
+// most chunks in flight a host may ask for
+#ifndef LOG_PROTO_WINDOW_MAX
+#define LOG_PROTO_WINDOW_MAX 16
+#endif
+
+// oldest unacknowledged chunk goes out again after this long
+#ifndef LOG_PROTO_RETRY_MS
+#define LOG_PROTO_RETRY_MS 500
+#endif
+
+// binary mode ends after this long without a valid frame
+#ifndef LOG_PROTO_IDLE_MS
+#define LOG_PROTO_IDLE_MS 30000
+#endif
+
+// 'E' codes
+enum {
+  LOG_PROTO_DONE = 0,     // offset is the end of the transfer
+  LOG_PROTO_GONE,         // evicted meanwhile, offset is the oldest still there
+  LOG_PROTO_BAD_REQUEST,
+};
+
+typedef struct {
+  uint32_t frames_in;
+  uint32_t frames_bad;    // CRC or length didn't match
+  uint32_t chunks_sent;
+  uint32_t chunks_resent; // on request or after a timeout
+  uint32_t bytes_sent;    // chunk data
+} log_proto_stats_t;
+
+// switch the CDC port to binary frames
+void log_proto_enter(void);
+
+bool log_proto_active(void);
+
+// bytes received from the CDC port while active
+void log_proto_rx(uint8_t const *data, uint32_t len);
+
+// send what the window and the TX FIFO allow, call from the core0 loop
+void log_proto_task(void);
+
+void log_proto_get_stats(log_proto_stats_t *stats);
+
+#endif /* LOG_PROTO_H_ */
@@ -0,0 +1,174 @@
+#include <assert.h>
+#include <string.h>
+
+#include "log_tail.h"
+
+// A byte ring of entries: entry_t, then the payload, padded to 4 bytes. An
+// entry never wraps; if it doesn't fit before the end, a type 0 header marks
+// the rest of the ring unused and the entry starts over at offset 0. Offsets
+// are free running.
+
+typedef struct {
+  uint8_t type;       // 0 = skip to the start of the ring
+  uint8_t len;
+  uint16_t reserved;
+  uint32_t time_ms;
+} entry_t;
+
+#define WRAP 0
+
+static_assert(LOG_TAIL_CACHE_SIZE % 4 == 0, "the cache size must be a multiple of 4");
+static_assert(LOG_TAIL_CACHE_SIZE == 0 || LOG_TAIL_CACHE_SIZE >= 2 * (sizeof(entry_t) + JOURNAL_RECORD_MAX + 3),
+              "the cache must hold at least two records");
+
+#if LOG_TAIL_CACHE_SIZE
+static uint8_t ring[LOG_TAIL_CACHE_SIZE];
+#else
+static uint8_t ring[sizeof(entry_t)];
+#endif
+
+static uint32_t head = 0;   // where the next entry goes
+static uint32_t tail = 0;   // oldest entry
+static uint16_t count = 0;  // records between them
+
+static log_tail_stats_t stats;
+
+static uint32_t phys(uint32_t pos)
+{
+  return pos % sizeof(ring);
+}
+
+static uint32_t entry_size(uint8_t len)
+{
+  return (sizeof(entry_t) + len + 3) & ~3u;
+}
+
+static void read_entry(uint32_t pos, entry_t *e)
+{
+  memcpy(e, &ring[phys(pos)], sizeof(*e));
+}
+
+// position after the entry (or wrap marker) at pos
+static uint32_t next_pos(uint32_t pos)
+{
+  entry_t e;
+  read_entry(pos, &e);
+  if (e.type == WRAP) return pos + sizeof(ring) - phys(pos);
+  return pos + entry_size(e.len);
+}
+
+// first record at or after pos
+static uint32_t skip_wrap(uint32_t pos)
+{
+  entry_t e;
+  while (pos != head) {
+    read_entry(pos, &e);
+    if (e.type != WRAP) break;
+    pos = next_pos(pos);
+  }
+  return pos;
+}
+
+static void evict(void)
+{
+  entry_t e;
+  read_entry(tail, &e);
+  if (e.type != WRAP) {
+    count--;
+    stats.records_evicted++;
+  }
+  tail = next_pos(tail);
+}
+
+void log_tail_add(uint8_t type, uint8_t const *data, uint8_t len, uint32_t time_ms)
+{
+  if (!LOG_TAIL_CACHE_SIZE) return;
+
+  uint32_t const need = entry_size(len);
+  uint32_t const room_to_end = sizeof(ring) - phys(head);
+
+  // keep a header's room after every entry, so a wrap marker always fits
+  if (room_to_end < need + sizeof(entry_t)) {
+    while (head + room_to_end - tail > sizeof(ring)) evict();
+    entry_t const wrap = { WRAP, 0, 0, 0 };
+    memcpy(&ring[phys(head)], &wrap, sizeof(wrap));
+    head += room_to_end;
+  }
+
+  while (head + need - tail > sizeof(ring)) evict();
+
+  entry_t const e = { type, len, 0, time_ms };
+  memcpy(&ring[phys(head)], &e, sizeof(e));
+  memcpy(&ring[phys(head) + sizeof(e)], data, len);
+
+  head += need;
+  count++;
+  stats.records_cached++;
+}
+
+void log_tail_clear(void)
+{
+  head = tail = 0;
+  count = 0;
+}
+
+bool log_tail_seek(log_tail_cursor_t *cursor, uint32_t time_ms)
+{
+  cursor->pos = skip_wrap(tail);
+
+  // Blocks are in time order, so everything from time_ms on is here if the
+  // oldest timed record started at or before it. Untimed (text) records
+  // ahead of it don't matter to time queries.
+  uint32_t pos = cursor->pos;
+  while (pos != head) {
+    entry_t e;
+    read_entry(pos, &e);
+    if (e.type != WRAP && e.time_ms) {
+      if (e.time_ms <= time_ms) {
+        stats.hits++;
+        return true;
+      }
+      break;
+    }
+    pos = next_pos(pos);
+  }
+
+  stats.misses++;
+  return false;
+}
+
+void log_tail_last(log_tail_cursor_t *cursor, uint16_t n)
+{
+  uint16_t skip = count > n ? (uint16_t) (count - n) : 0;
+
+  cursor->pos = skip_wrap(tail);
+  while (skip--) cursor->pos = skip_wrap(next_pos(cursor->pos));
+
+  stats.hits++;
+}
+
+bool log_tail_next(log_tail_cursor_t *cursor, journal_record_t *record)
+{
+  // fell behind the writer, what it pointed at was overwritten
+  if ((int32_t) (cursor->pos - tail) < 0) cursor->pos = tail;
+
+  cursor->pos = skip_wrap(cursor->pos);
+  if (cursor->pos == head) return false;
+
+  entry_t e;
+  read_entry(cursor->pos, &e);
+
+  record->type = e.type;
+  record->len = e.len;
+  record->data = &ring[phys(cursor->pos) + sizeof(entry_t)];
+  cursor->pos += entry_size(e.len);
+  stats.records_served++;
+  return true;
+}
+
+void log_tail_get_stats(log_tail_stats_t *out)
+{
+  *out = stats;
+  out->used = (uint16_t) (head - tail);
+  out->size = LOG_TAIL_CACHE_SIZE;
+}
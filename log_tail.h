@@ -0,0 +1,53 @@
+#ifndef LOG_TAIL_H_
+#define LOG_TAIL_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "journal.h"
+
+// SRAM copy of the most recent log records, filled by the log writer as it
+// appends them to the journal. Queries about the recent past are answered
+// from here without reading flash (which would compete with XIP fetches and
+// miss pages still waiting in the flash queue).
+
+// bytes of SRAM for the cache, 0 disables it
+#ifndef LOG_TAIL_CACHE_SIZE
+#define LOG_TAIL_CACHE_SIZE 4096
+#endif
+
+typedef struct {
+  uint32_t hits;          // queries served from SRAM
+  uint32_t misses;        // queries that reached back further and went to flash
+  uint32_t records_served;
+  uint32_t records_cached;
+  uint32_t records_evicted;
+  uint16_t used;          // bytes holding records right now
+  uint16_t size;
+} log_tail_stats_t;
+
+typedef struct {
+  uint32_t pos;
+} log_tail_cursor_t;
+
+// a record the writer just appended to the journal, time_ms is when its first
+// event happened (0 if it has no time)
+void log_tail_add(uint8_t type, uint8_t const *data, uint8_t len, uint32_t time_ms);
+
+// forget everything, when the journal is emptied
+void log_tail_clear(void);
+
+// Start reading the cache if it holds everything from time_ms on, counting a
+// hit; false (and a miss) if older records are needed from flash.
+bool log_tail_seek(log_tail_cursor_t *cursor, uint32_t time_ms);
+
+// the last count records, or as many as there are; counts a hit
+void log_tail_last(log_tail_cursor_t *cursor, uint16_t count);
+
+// next record, oldest first; data points into the cache and stays valid until
+// the next log_tail_add()
+bool log_tail_next(log_tail_cursor_t *cursor, journal_record_t *record);
+
+void log_tail_get_stats(log_tail_stats_t *stats);
+
+#endif /* LOG_TAIL_H_ */
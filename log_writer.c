@@ -0,0 +1,356 @@
+#include <assert.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+
+#include "log_writer.h"
+#include "journal.h"
+#include "log_compress.h"
+#include "event_log.h"
+#include "key_diff.h"
+#include "log_tail.h"
+
+// Bytes are gathered in a RAM stage and only appended to the journal as text
+// records + synced (which is what costs a flash program) once the stage is
+// full, too old, or a sync is requested. With LOG_WRITER_COMPRESS a stage
+// becomes one compressed record when that is smaller. A commit only queues
+// the flash work, log_writer_sync() also waits for it.
+//
+// Input events are staged the same way, encoded as one event_log block that
+// becomes one JOURNAL_REC_EVENTS record. A stage holds either text or events,
+// switching commits it.
+
+static bool log_open = false;
+
+static uint8_t stage[LOG_WRITER_STAGE_SIZE];
+static uint16_t stage_len = 0;
+static uint8_t stage_type = JOURNAL_REC_TEXT;
+static uint32_t stage_raw = 0;       // what the stage stands for, see total_bytes
+static uint32_t stage_first_ms = 0;  // when the oldest staged byte arrived
+static uint32_t stage_time_ms = 0;   // journal clock of the first staged event
+static event_log_writer_t enc;
+
+static log_writer_stats_t stats;
+static uint32_t window_start_ms = 0;
+static uint32_t window_bytes = 0;
+static uint32_t window_commits = 0;
+
+// into the journal, and into the tail cache once it is there
+static int append_record(uint8_t type, uint8_t const *data, uint16_t len, uint32_t time_ms)
+{
+  int err = journal_append(type, data, len);
+  if (err == LFS_ERR_OK) log_tail_add(type, data, (uint8_t) len, time_ms);
+  return err;
+}
+
+// split into as many records as it takes
+static int append_text(uint8_t const *data, uint32_t len)
+{
+  while (len) {
+    uint16_t n = len > JOURNAL_RECORD_MAX ? JOURNAL_RECORD_MAX : (uint16_t) len;
+    int err = append_record(JOURNAL_REC_TEXT, data, n, 0);
+    if (err != LFS_ERR_OK) return err;
+    data += n;
+    len -= n;
+  }
+  return LFS_ERR_OK;
+}
+
+static_assert((int) EVENT_LOG_KEY_DOWN == EVENT_KEY_DOWN && (int) EVENT_LOG_KEY_UP == EVENT_KEY_UP &&
+              (int) EVENT_LOG_MOUSE_BUTTONS == EVENT_MOUSE_BUTTONS, "event types must match");
+static_assert(LOG_WRITER_STAGE_SIZE <= LOG_COMPRESS_BLOCK_MAX, "a stage must fit one compressed block");
+
+static int append_stage(void)
+{
+  if (stage_type == JOURNAL_REC_EVENTS) {
+    stats.stored_bytes += stage_len;
+    return append_record(JOURNAL_REC_EVENTS, stage, stage_len, stage_time_ms);
+  }
+
+  if (LOG_WRITER_COMPRESS) {
+    uint8_t block[JOURNAL_RECORD_MAX];
+    // only worth it if it comes out smaller
+    uint16_t cap = stage_len <= sizeof(block) ? (uint16_t) (stage_len - 1) : (uint16_t) sizeof(block);
+
+    uint32_t start = time_us_32();
+    uint16_t n = log_compress(stage, stage_len, block, cap);
+    stats.compress_us += time_us_32() - start;
+
+    if (n) {
+      stats.stored_bytes += n;
+      return append_record(JOURNAL_REC_TEXT_LZ, block, n, 0);
+    }
+  }
+
+  stats.stored_bytes += stage_len;
+  return append_text(stage, stage_len);
+}
+
+static int commit_stage(void)
+{
+  if (!log_open) return LFS_ERR_BADF;
+  if (stage_len == 0) return LFS_ERR_OK;
+
+  uint32_t start = time_us_32();
+
+  int err = append_stage();
+  if (err == LFS_ERR_OK) err = journal_sync();
+
+  uint32_t elapsed = time_us_32() - start;
+  if (elapsed > stats.worst_commit_us) stats.worst_commit_us = elapsed;
+
+  if (err != LFS_ERR_OK) {
+    // drop the stage, a retry would append the records that did make it twice
+    stats.errors++;
+    stage_len = 0;
+    stage_raw = 0;
+    return err;
+  }
+
+  stats.total_bytes += stage_raw;
+  stats.total_commits++;
+  window_bytes += stage_raw;
+  window_commits++;
+  stage_len = 0;
+  stage_raw = 0;
+
+  return LFS_ERR_OK;
+}
+
+// newest event time in the head segment, the segment headers alone only know
+// when it was opened
+static uint32_t last_logged_ms(void)
+{
+  journal_cursor_t cursor;
+  journal_record_t rec;
+  uint32_t last = 0;
+
+  journal_seek(&cursor, UINT32_MAX);
+  while (journal_next(&cursor, &rec)) {
+    event_log_reader_t r;
+    event_log_event_t ev;
+
+    if (rec.type != JOURNAL_REC_EVENTS || !event_log_reader_init(&r, rec.data, rec.len)) continue;
+    last = r.time_ms;
+    while (event_log_next(&r, &ev)) last = ev.time_ms;
+  }
+  return last;
+}
+
+int log_writer_init(void)
+{
+  journal_time_floor(last_logged_ms());
+  log_tail_clear();
+
+  stage_len = 0;
+  window_start_ms = to_ms_since_boot(get_absolute_time());
+  log_open = true;
+  return LFS_ERR_OK;
+}
+
+bool log_writer_append(const void *data, uint32_t len)
+{
+  if (!log_open) return false;
+
+  if (stage_len && (stage_type != JOURNAL_REC_TEXT || stage_len + len > sizeof(stage))) {
+    if (commit_stage() != LFS_ERR_OK) return false;
+  }
+  stage_type = JOURNAL_REC_TEXT;
+
+  // too big to stage at all, write straight through
+  if (len > sizeof(stage)) {
+    if (append_text(data, len) != LFS_ERR_OK) {
+      stats.errors++;
+      return false;
+    }
+    stats.total_bytes += len;
+    stats.stored_bytes += len;
+    window_bytes += len;
+    return true;
+  }
+
+  if (stage_len == 0) stage_first_ms = to_ms_since_boot(get_absolute_time());
+
+  memcpy(&stage[stage_len], data, len);
+  stage_len += len;
+  stage_raw += len;
+
+  if (stage_len == sizeof(stage)) commit_stage();
+
+  return true;
+}
+
+// start a block whose sync marker takes its time and device from ev
+static void begin_events(event_log_event_t const *ev, uint8_t modifier)
+{
+  stage_type = JOURNAL_REC_EVENTS;
+  stage_first_ms = to_ms_since_boot(get_absolute_time());
+  stage_time_ms = ev->time_ms;
+  event_log_begin(&enc, stage, JOURNAL_RECORD_MAX, ev->time_ms, ev->dev_addr, ev->instance, modifier);
+  stage_len = enc.len;
+}
+
+bool log_writer_event(input_event_t const *event)
+{
+  if (!log_open) return false;
+
+  // core1 stamped it in microseconds, the log counts in journal clock ms
+  uint32_t const age_ms = (time_us_32() - event->time_us) / 1000;
+  event_log_event_t const ev = {
+    .time_ms = journal_time_ms() - age_ms,
+    .type = event->type,
+    .dev_addr = event->dev_addr,
+    .instance = event->instance,
+    .code = event->keycode,
+  };
+
+  // the modifier byte before this event, which is what the block starts with
+  uint8_t modifier = event->modifier;
+  if (event->type != EVENT_MOUSE_BUTTONS && event->keycode >= KEY_USAGE_MODIFIER_FIRST) {
+    modifier ^= (uint8_t) (1u << (event->keycode - KEY_USAGE_MODIFIER_FIRST));
+  }
+
+  if (stage_len && stage_type != JOURNAL_REC_EVENTS) {
+    if (commit_stage() != LFS_ERR_OK) return false;
+  }
+  if (stage_len == 0) begin_events(&ev, modifier);
+
+  if (!event_log_put(&enc, &ev)) {
+    if (commit_stage() != LFS_ERR_OK) return false;
+    begin_events(&ev, modifier);
+    event_log_put(&enc, &ev);
+  }
+
+  stage_len = enc.len;
+  stage_raw += sizeof(input_event_t);
+  return true;
+}
+
+void log_writer_task(void)
+{
+  uint32_t now = to_ms_since_boot(get_absolute_time());
+
+  if (stage_len && now - stage_first_ms >= LOG_WRITER_MAX_AGE_MS) {
+    commit_stage();
+  }
+
+  // roll the per-second counters
+  if (now - window_start_ms >= 1000) {
+    stats.bytes_per_sec = window_bytes;
+    stats.commits_per_sec = window_commits;
+    window_bytes = 0;
+    window_commits = 0;
+    window_start_ms = now;
+  }
+}
+
+int log_writer_sync(void)
+{
+  int err = commit_stage();
+  if (err != LFS_ERR_OK) return err;
+  return journal_flush();
+}
+
+int log_writer_commit(void)
+{
+  return commit_stage();
+}
+
+int log_writer_close(void)
+{
+  if (!log_open) return LFS_ERR_OK;
+
+  int err = commit_stage();
+  log_open = false;
+  return err;
+}
+
+int log_writer_truncate(void)
+{
+  // anything still staged belongs to the log being thrown away
+  stage_len = 0;
+  stage_raw = 0;
+  log_tail_clear();
+  return journal_format();
+}
+
+// characters typed in an event block between from_ms and to_ms; a block full
+// of repeats can stand for more than fits, the rest is cut off
+static uint16_t events_text(event_log_reader_t *r, uint32_t from_ms, uint32_t to_ms, uint8_t *buf)
+{
+  event_log_event_t ev;
+  uint16_t n = 0;
+
+  while (n < LOG_WRITER_STAGE_SIZE) {
+    uint8_t modifier = r->modifier;
+    if (!event_log_next(r, &ev) || ev.time_ms > to_ms) break;
+    if (ev.type != EVENT_LOG_KEY_DOWN || ev.time_ms < from_ms) continue;
+
+    uint8_t c = key_usage_to_ascii(ev.code, modifier);
+    if (c) buf[n++] = c;
+  }
+  return n;
+}
+
+uint8_t const *log_writer_record_text(journal_record_t const *rec, uint8_t *buf, uint16_t *len)
+{
+  if (rec->type == JOURNAL_REC_EVENTS) {
+    event_log_reader_t r;
+    if (!event_log_reader_init(&r, rec->data, rec->len)) return NULL;
+
+    *len = events_text(&r, 0, UINT32_MAX, buf);
+    return buf;
+  }
+
+  if (rec->type == JOURNAL_REC_TEXT) {
+    *len = rec->len;
+    return rec->data;
+  }
+
+  if (rec->type == JOURNAL_REC_TEXT_LZ) {
+    *len = log_decompress(rec->data, rec->len, buf, LOG_WRITER_STAGE_SIZE);
+    return *len ? buf : NULL;
+  }
+
+  return NULL;
+}
+
+bool log_writer_staged(journal_record_t *rec)
+{
+  if (!stage_len || stage_len > JOURNAL_RECORD_MAX) return false;
+
+  rec->type = stage_type;
+  rec->len = (uint8_t) stage_len;
+  rec->data = stage;
+  return true;
+}
+
+bool log_writer_range_text(journal_record_t const *rec, uint32_t from_ms, uint32_t to_ms,
+                           uint8_t *buf, uint16_t *len)
+{
+  event_log_reader_t r;
+  *len = 0;
+
+  // only event blocks carry times
+  if (rec->type != JOURNAL_REC_EVENTS || !event_log_reader_init(&r, rec->data, rec->len)) return true;
+
+  // blocks are written in time order, nothing further can be in range
+  if (r.time_ms > to_ms) return false;
+
+  *len = events_text(&r, from_ms, to_ms, buf);
+  return true;
+}
+
+void log_writer_get_stats(log_writer_stats_t *out)
+{
+  *out = stats;
+  out->staged = stage_len;
+}
+
+void log_writer_reset_stats(void)
+{
+  memset(&stats, 0, sizeof(stats));
+  window_bytes = 0;
+  window_commits = 0;
+  window_start_ms = to_ms_since_boot(get_absolute_time());
+}
@@ -0,0 +1,85 @@
+#ifndef LOG_WRITER_H_
+#define LOG_WRITER_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lfs.h"
+#include "journal.h"
+#include "event_ring.h"
+
+// bytes gathered in RAM before they are committed to flash
+#ifndef LOG_WRITER_STAGE_SIZE
+#define LOG_WRITER_STAGE_SIZE 256
+#endif
+
+// oldest staged byte is committed after this long, even if the stage isn't full
+#ifndef LOG_WRITER_MAX_AGE_MS
+#define LOG_WRITER_MAX_AGE_MS 2000
+#endif
+
+// 1: commit each text stage as a compressed block when that saves space;
+// event blocks (LOG_WRITER_EVENTS) are already packed and stored as they are
+#ifndef LOG_WRITER_COMPRESS
+#define LOG_WRITER_COMPRESS 0
+#endif
+
+// 1: log every input event in the event_log.h format, 0: only typed characters
+#ifndef LOG_WRITER_EVENTS
+#define LOG_WRITER_EVENTS 1
+#endif
+
+typedef struct {
+  uint32_t bytes_per_sec;     // bytes committed during the last full second
+  uint32_t commits_per_sec;   // commits during the last full second
+  uint32_t worst_commit_us;   // longest single commit since boot / stats reset
+  uint32_t total_bytes;       // text bytes, or sizeof(input_event_t) per event
+  uint32_t total_commits;
+  uint32_t errors;            // failed appends or syncs
+  uint32_t stored_bytes;      // what total_bytes took in the journal
+  uint32_t compress_us;       // CPU time spent compressing
+  uint16_t staged;            // bytes currently waiting in RAM
+} log_writer_stats_t;
+
+// start logging into the journal, which must already be initialised
+int log_writer_init(void);
+
+// copy data into the RAM stage, commits first if it doesn't fit
+bool log_writer_append(const void *data, uint32_t len);
+
+// stage one input event, encoded; commits first if the block is full
+bool log_writer_event(input_event_t const *event);
+
+// call from the core0 loop, commits the stage once it gets too old
+void log_writer_task(void);
+
+// commit everything staged so far and wait until it is in flash, returns a LittleFS error code
+int log_writer_sync(void);
+
+// commit everything staged so far, flash_sched programs it in its own time
+int log_writer_commit(void);
+
+// commit and stop accepting data, e.g. before the storage is reformatted
+int log_writer_close(void);
+
+// empty the log, keeping the writer open
+int log_writer_truncate(void);
+
+// text held by a TEXT, TEXT_LZ or EVENTS record (the characters typed), NULL
+// for other records or a damaged block; buf needs LOG_WRITER_STAGE_SIZE bytes
+// and is used for decompressing
+uint8_t const *log_writer_record_text(journal_record_t const *rec, uint8_t *buf, uint16_t *len);
+
+// what is staged and not yet committed, as the record it will become
+// (uncompressed); false if nothing is. Valid until the next log writer call.
+bool log_writer_staged(journal_record_t *rec);
+
+// characters typed between from_ms and to_ms (journal clock) in an EVENTS
+// record, other records give none; false once records start after to_ms
+bool log_writer_range_text(journal_record_t const *rec, uint32_t from_ms, uint32_t to_ms,
+                           uint8_t *buf, uint16_t *len);
+
+void log_writer_get_stats(log_writer_stats_t *stats);
+void log_writer_reset_stats(void);
+
+#endif /* LOG_WRITER_H_ */
@@ -45,10 +45,33 @@
 #include "hardware/clocks.h"
 
 #include "pinconfig.h"
-#include "pico/util/queue.h"
 #include "pico_lfs.h"
-
-#define FS_SIZE (256 * 1024)
+#include "log_writer.h"
+#include "journal.h"
+#include "flash_sched.h"
+#include "maintenance.h"
+#include "log_tail.h"
+#include "log_dump.h"
+#include "log_proto.h"
+#include "jobs.h"
+#include "log_live.h"
+#include "msc_log.h"
+#include "event_ring.h"
+#include "hid_forward.h"
+
+// LittleFS only keeps small files (journal superblock, config), the log itself
+// goes into the journal region right below it
+#define FS_SIZE (32 * 1024)
+#define JOURNAL_OFFSET (PICO_FLASH_SIZE_BYTES - FS_SIZE - JOURNAL_SIZE)
+
+// set by the RUN_FROM_RAM cmake option
+#ifndef RUN_FROM_RAM
+#define RUN_FROM_RAM 0
+#endif
+
+// appends per storage path in the logbench command
+#define BENCH_APPENDS 32
+#define BENCH_PAYLOAD 32
 
 /*------------- MAIN -------------*/
 
@@ -64,9 +87,8 @@ extern volatile bool core1_ready;
 static struct lfs_config *lfs_cfg;
 lfs_t lfs;
 
-// set up queue
-#define KEYPRESS_QUEUE_SIZE 256
-queue_t keypress_queue;
+// when the main loop started forwarding, ms since boot
+static uint32_t boot_ready_ms = 0;
 
 
 // core0: handle device events
@@ -90,6 +112,9 @@ int main(void) {
   if (!lfs_cfg)
       panic("out of memory");
 
+  // LittleFS only holds the journal's superblock file, and the journal
+  // (outside it) is kept when that goes missing, so formatting on any mount
+  // error loses no log
   int err = lfs_mount(&lfs, lfs_cfg);
   if (err != LFS_ERR_OK) {
       err = lfs_format(&lfs, lfs_cfg);
@@ -100,27 +125,49 @@ int main(void) {
           panic("failed to mount new filesystem");
   }
 
-  queue_init(&keypress_queue, sizeof(uint8_t), KEYPRESS_QUEUE_SIZE);
+  if (journal_init(&lfs, JOURNAL_OFFSET, JOURNAL_SIZE) != LFS_ERR_OK)
+      panic("failed to open journal");
+  log_writer_init();
+  maintenance_init(&lfs);
+
+  hid_forward_latency_reset();
 
   // init device stack on native usb (roothub port0)
   tud_init(0);
   setup_cdc_mode();
   //check_cdc_mode();
+
+  boot_ready_ms = to_ms_since_boot(get_absolute_time());
   
   // device task, handles sending all CDC and HID events over USB to real host
   while (true) {
 
     check_cdc_mode();
 
-    uint8_t ch;
-    if (queue_try_remove(&keypress_queue, &ch)) {
-      lfs_file_t file;
-      lfs_file_open(&lfs, &file, "strings", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND);
-      lfs_file_write(&lfs, &file, &ch, 1);
-      lfs_file_close(&lfs, &file);
+    // stage input in RAM, the log writer decides when to hit flash
+    input_event_t events[16];
+    uint32_t n_events;
+    while ((n_events = event_ring_pop(events, count_of(events))) > 0) {
+      flash_sched_note_input();
+      for (uint32_t i = 0; i < n_events; i++) {
+        log_live_event(&events[i]);
+        if (LOG_WRITER_EVENTS) {
+          log_writer_event(&events[i]);
+        } else if (events[i].type == EVENT_KEY_DOWN && events[i].ascii) {
+          log_writer_append(&events[i].ascii, 1);
+        }
+      }
     }
+    log_writer_task();
 
     tud_task(); // tinyusb device task, process all usb events (CDC & HID)
+    hid_forward_task(); // send reports core1 handed over as soon as the endpoint is free
+    jobs_task(); // a slice of a long command (dump, format) that is running
+    log_live_task(); // at most one packet of live events per frame
+    log_proto_task(); // binary retrieval, when the CDC port is in binary mode
+    if (hid_forward_busy()) flash_sched_note_input();
+    maintenance_task(); // pre-erase and gc once input goes quiet
+    flash_sched_task(); // program queued journal pages between host frames
     tud_cdc_write_flush(); // send all data when available
 
   }
@@ -135,75 +182,601 @@ static void cmd_help(void)
     tud_cdc_write_str("\r\nAvailable Commands:\r\n");
     tud_cdc_write_str("  help - Show this help\r\n");
     tud_cdc_write_str("  dumpstrings - Dump contents of strings file\r\n");
+    tud_cdc_write_str("  dump <from> [<to>] - Dump text typed in a time range (s, negative = ago)\r\n");
     tud_cdc_write_str("  resetstrings - Clear the strings file\r\n");
     tud_cdc_write_str("  teststring - Append test string\r\n");
-    tud_cdc_write_str("  resetfilesystem - Format filesystem\r\n");
+    tud_cdc_write_str("  resetfilesystem - Format filesystem and journal\r\n");
+    tud_cdc_write_str("  sync - Commit staged log data to flash\r\n");
+    tud_cdc_write_str("  logstats - Show log writer and journal statistics\r\n");
+    tud_cdc_write_str("  logbench - Compare LittleFS and journal append speed (writes flash)\r\n");
+    tud_cdc_write_str("  eventstats - Show core1 to core0 event ring statistics\r\n");
+    tud_cdc_write_str("  fwdstats - Show HID forwarding statistics\r\n");
+    tud_cdc_write_str("  latency - Show pass-through and log append latency\r\n");
+    tud_cdc_write_str("  latencyreset - Clear the latency histograms\r\n");
+    tud_cdc_write_str("  framestats - Show USB host frames missed, e.g. during flash writes\r\n");
+    tud_cdc_write_str("  framereset - Clear the missed frame counters\r\n");
+    tud_cdc_write_str("  flashstats - Show flash scheduler and maintenance statistics\r\n");
+    tud_cdc_write_str("  maintenance - Toggle idle pre-erase and gc\r\n");
+    tud_cdc_write_str("  dumpstats - Show size and speed of the last dump\r\n");
+    tud_cdc_write_str("  jobs - Show the running dump or format and its progress\r\n");
+    tud_cdc_write_str("  cancel - Stop the running dump\r\n");
+    tud_cdc_write_str("  tail [bin] - Follow input as it is logged, as text or event blocks\r\n");
+    tud_cdc_write_str("  binary - Switch to framed binary log retrieval, see log_proto.h\r\n");
+}
+
+//--------------------------------------------------------------------+
+// Jobs
+//--------------------------------------------------------------------+
+
+// dump: what is staged goes to flash first, in the scheduler's windows like
+// any other page, then log_dump streams as the FIFO drains; progress is
+// bytes sent
+enum {
+    DUMP_COMMIT = 0,
+    DUMP_FLUSH,
+    DUMP_STREAM,
+};
+
+static bool dump_ranged;
+static uint32_t dump_from_ms;
+static uint32_t dump_to_ms;
+
+static int dump_step(job_t *job)
+{
+    flash_sched_stats_t fs;
+
+    switch (job->phase) {
+    case DUMP_COMMIT:
+        // a failed commit still leaves the rest of the log to dump
+        log_writer_commit();
+        job->phase = DUMP_FLUSH;
+        return JOB_MORE;
+
+    case DUMP_FLUSH:
+        flash_sched_get_stats(&fs);
+        if (fs.queued) return JOB_WAIT;
+
+        if (dump_ranged) {
+            log_dump_start_range(dump_from_ms, dump_to_ms);
+        } else {
+            log_dump_start_all();
+        }
+        job->phase = DUMP_STREAM;
+        return JOB_MORE;
+
+    default:
+        break;
+    }
+
+    log_dump_task();
+
+    log_dump_stats_t ds;
+    log_dump_get_stats(&ds);
+    job->done = ds.bytes;
+    return ds.active ? JOB_WAIT : JOB_DONE;
+}
+
+static void dump_cancel(job_t *job)
+{
+    (void) job;
+    log_dump_cancel();
+}
+
+static job_t dump_job = { .name = "dump", .step = dump_step, .cancel = dump_cancel };
+
+// format: LittleFS (resetfilesystem only), then the journal, whose old
+// segments are invalidated one page program at a time; progress is segments
+enum {
+    FORMAT_FS = 0,
+    FORMAT_JOURNAL,
+    FORMAT_INVALIDATE,
+    FORMAT_FLUSH,
+};
+
+static int format_step(job_t *job)
+{
+    int err;
+    flash_sched_stats_t fs;
+
+    switch (job->phase) {
+    case FORMAT_FS:
+        // LittleFS only rewrites its superblock pair here, the one step
+        // that may hold the loop for more than a slice
+        log_writer_close();
+        if ((err = lfs_unmount(&lfs)) < 0 ||
+            (err = lfs_format(&lfs, lfs_cfg)) < 0 ||
+            (err = lfs_mount(&lfs, lfs_cfg)) < 0 ||
+            (err = journal_init(&lfs, JOURNAL_OFFSET, JOURNAL_SIZE)) < 0 ||
+            (err = log_writer_init()) < 0) {
+            return err;
+        }
+        job->phase = FORMAT_JOURNAL;
+        return JOB_MORE;
+
+    case FORMAT_JOURNAL:
+        if ((err = log_writer_truncate()) < 0) return err;
+        job->total = journal_format_pending();
+        job->phase = FORMAT_INVALIDATE;
+        return JOB_MORE;
+
+    case FORMAT_INVALIDATE:
+        // leave the flash queue room, so nothing has to be forced
+        flash_sched_get_stats(&fs);
+        if (fs.queued >= FLASH_SCHED_QUEUE_SIZE / 2) return JOB_WAIT;
+
+        if ((err = journal_format_step()) < 0) return err;
+        job->done = job->total - journal_format_pending();
+        if (!journal_format_pending()) job->phase = FORMAT_FLUSH;
+        return JOB_MORE;
+
+    default:
+        // done once the scheduler has written it all
+        flash_sched_get_stats(&fs);
+        if (fs.queued) return JOB_WAIT;
+        tud_cdc_write_str("\r\nDone\r\n");
+        return JOB_DONE;
+    }
+}
+
+static job_t format_job = { .name = "resetfilesystem", .step = format_step };
+
+static int reset_step(job_t *job)
+{
+    if (job->phase == FORMAT_FS) job->phase = FORMAT_JOURNAL;
+    return format_step(job);
+}
+
+static job_t reset_job = { .name = "resetstrings", .step = reset_step };
+
+static bool start_job(job_t *job)
+{
+    if (jobs_start(job)) return true;
+
+    tud_cdc_write_str("\r\nBusy, see 'jobs'\r\n");
+    return false;
 }
 
 static void cmd_dumpstrings(void)
 {
+    if (!start_job(&dump_job)) return;
+
     tud_cdc_write_str("\r\nDumping strings file...\r\n");
-    
-    lfs_file_t file; 
-    lfs_file_open(&lfs, &file, "strings", LFS_O_RDONLY | LFS_O_CREAT);
-    char buffer[128];
-    lfs_ssize_t bytes_read;
-    
-    while ((bytes_read = lfs_file_read(&lfs, &file, buffer, sizeof(buffer))) > 0) {
-        for (lfs_ssize_t i = 0; i < bytes_read; i++) {
-            tud_cdc_write(&buffer[i], 1);
-        }
+
+    // the main loop streams it out as the FIFO drains
+    dump_ranged = false;
+}
+
+// dump <from> [<to>]: text typed between two journal clock times in seconds,
+// negative values count back from now
+static void cmd_dump(const char *args)
+{
+    char *end;
+    int32_t now_s = (int32_t) (journal_time_ms() / 1000);
+
+    long from = strtol(args, &end, 10);
+    if (end == args) {
+        tud_cdc_write_str("\r\nUsage: dump <from> [<to>] (seconds, negative = ago)\r\n");
+        return;
     }
-    
-    lfs_file_close(&lfs, &file);
-    tud_cdc_write_str("\r\nDone\r\n");
+    const char *rest = end;
+    long to = strtol(rest, &end, 10);
+    if (end == rest) to = now_s;
+    if (from < 0) from += now_s;
+    if (to < 0) to += now_s;
+    if (from < 0) from = 0;
+    if (to < from) {
+        tud_cdc_write_str("\r\nEmpty range\r\n");
+        return;
+    }
+
+    if (!start_job(&dump_job)) return;
+
+    uint32_t const from_ms = (uint32_t) from * 1000;
+    uint32_t const to_ms = (uint32_t) to * 1000 + 999;
+
+    char head[64];
+    int count = snprintf(head, sizeof(head), "\r\nDumping %ld..%ld s (now %ld s)...\r\n", from, to, (long) now_s);
+    tud_cdc_write(head, count);
+
+    dump_ranged = true;
+    dump_from_ms = from_ms;
+    dump_to_ms = to_ms;
 }
 
 static void cmd_resetstrings(void)
 {
+    if (!start_job(&reset_job)) return;
+
     tud_cdc_write_str("\r\nResetting strings file...\r\n");
-    
-    lfs_file_t file;
-    lfs_file_open(&lfs, &file, "strings", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC);
-    lfs_file_write(&lfs, &file, "", 0);
-    lfs_file_close(&lfs, &file);
-    
-    tud_cdc_write_str("Done\r\n");
 }
 
 static void cmd_teststring(void)
 {
     tud_cdc_write_str("\r\nAppending test string...\r\n");
     
-    lfs_file_t file;
     const char *test_string = "DEBUG STRING";
     
-    lfs_file_open(&lfs, &file, "strings", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_APPEND);
-    lfs_ssize_t bytes_written = lfs_file_write(&lfs, &file, test_string, strlen(test_string));
-    
-    if (bytes_written < 0) {
+    if (!log_writer_append(test_string, strlen(test_string)) ||
+        log_writer_sync() != LFS_ERR_OK) {
         tud_cdc_write_str("Error writing to file\r\n");
     } else {
         tud_cdc_write_str("Done\r\n");
     }
-    
-    lfs_file_close(&lfs, &file);
 }
 
 static void cmd_resetfilesystem(void)
 {
-    tud_cdc_write_str("\r\nFormatting filesystem...\r\n");
-    
-    if (lfs_unmount(&lfs) < 0 ||
-        lfs_format(&lfs, lfs_cfg) < 0 ||
-        lfs_mount(&lfs, lfs_cfg) < 0) {
+    if (!start_job(&format_job)) return;
+
+    tud_cdc_write_str("\r\nFormatting filesystem and journal...\r\n");
+}
+
+static void cmd_jobs(void)
+{
+    job_t const *job = jobs_current();
+    if (!job) {
+        tud_cdc_write_str("\r\nNo job running\r\n");
+        return;
+    }
+
+    char buf[96];
+    uint32_t const secs = (to_ms_since_boot(get_absolute_time()) - job->started_ms) / 1000;
+    int count;
+    if (job->total) {
+        count = snprintf(buf, sizeof(buf), "\r\n%s: %lu/%lu, %lu s%s\r\n", job->name,
+            (unsigned long) job->done, (unsigned long) job->total, (unsigned long) secs,
+            job->cancel ? "" : " (can't be cancelled)");
+    } else {
+        count = snprintf(buf, sizeof(buf), "\r\n%s: %lu, %lu s%s\r\n", job->name,
+            (unsigned long) job->done, (unsigned long) secs, job->cancel ? "" : " (can't be cancelled)");
+    }
+    tud_cdc_write(buf, count);
+}
+
+static void cmd_cancel(void)
+{
+    if (jobs_cancel()) {
+        tud_cdc_write_str("\r\nCancelled\r\n");
+    } else {
+        tud_cdc_write_str("\r\nNothing to cancel\r\n");
+    }
+}
+
+static void cmd_sync(void)
+{
+    tud_cdc_write_str("\r\nSyncing log...\r\n");
+
+    if (log_writer_sync() != LFS_ERR_OK) {
         tud_cdc_write_str("Error\r\n");
         return;
     }
-    
+
     tud_cdc_write_str("Done\r\n");
 }
 
+static void cmd_logstats(void)
+{
+    log_writer_stats_t st;
+    log_writer_get_stats(&st);
+
+    char buf[256];
+    int count = snprintf(buf, sizeof(buf),
+        "\r\nbytes/s: %lu  commits/s: %lu  worst commit: %lu us\r\n"
+        "total bytes: %lu  commits: %lu  errors: %lu  staged: %u\r\n",
+        (unsigned long) st.bytes_per_sec, (unsigned long) st.commits_per_sec,
+        (unsigned long) st.worst_commit_us, (unsigned long) st.total_bytes,
+        (unsigned long) st.total_commits, (unsigned long) st.errors, st.staged);
+    tud_cdc_write(buf, count);
+
+    // stored/raw in percent (raw being plain input_event_t structs in events
+    // format), and compressor time per KB of input
+    uint32_t ratio = st.total_bytes ? (uint32_t) ((uint64_t) st.stored_bytes * 100 / st.total_bytes) : 0;
+    uint32_t us_per_kb = st.total_bytes ? (uint32_t) ((uint64_t) st.compress_us * 1024 / st.total_bytes) : 0;
+    count = snprintf(buf, sizeof(buf),
+        "format: %s  compression: %s  stored: %lu bytes (%lu%%)  cpu: %lu us/KB\r\n",
+        LOG_WRITER_EVENTS ? "events" : "text", LOG_WRITER_COMPRESS ? "on" : "off",
+        (unsigned long) st.stored_bytes, (unsigned long) ratio, (unsigned long) us_per_kb);
+    tud_cdc_write(buf, count);
+
+    journal_stats_t js;
+    journal_get_stats(&js);
+
+    count = snprintf(buf, sizeof(buf),
+        "journal segments: %u/%u  records: %lu  bytes: %lu  pages: %lu  erases: %lu\r\n"
+        "fill: %lu/%lu KB (%lu%%)  evicted: %lu  torn: %lu  errors: %lu\r\n",
+        js.segments_used, js.segments_total, (unsigned long) js.records,
+        (unsigned long) js.bytes, (unsigned long) js.pages_programmed,
+        (unsigned long) js.segments_erased, (unsigned long) (js.fill_bytes / 1024),
+        (unsigned long) (js.capacity_bytes / 1024),
+        (unsigned long) (js.capacity_bytes ? (uint64_t) js.fill_bytes * 100 / js.capacity_bytes : 0),
+        (unsigned long) js.segments_evicted, (unsigned long) js.torn, (unsigned long) js.errors);
+    tud_cdc_write(buf, count);
+
+    count = snprintf(buf, sizeof(buf), "log time: %lu s\r\n", (unsigned long) (journal_time_ms() / 1000));
+    tud_cdc_write(buf, count);
+
+    count = snprintf(buf, sizeof(buf),
+        "boot: ready at %lu ms  journal mount: %lu us  batches: %lu  rolled back: %lu%s\r\n",
+        (unsigned long) boot_ready_ms, (unsigned long) js.mount_us, (unsigned long) js.commits,
+        (unsigned long) js.rolled_back, js.adopted ? "  (kept without superblock)" : "");
+    tud_cdc_write(buf, count);
+
+    log_tail_stats_t ts;
+    log_tail_get_stats(&ts);
+
+    count = snprintf(buf, sizeof(buf),
+        "tail cache: %u/%u bytes  hits: %lu  misses: %lu  served: %lu  cached: %lu  evicted: %lu\r\n",
+        ts.used, ts.size, (unsigned long) ts.hits, (unsigned long) ts.misses,
+        (unsigned long) ts.records_served, (unsigned long) ts.records_cached,
+        (unsigned long) ts.records_evicted);
+    tud_cdc_write(buf, count);
+}
+
+// one write + commit per append, the way the log writer commits, on both paths
+static void bench_report(const char *name, lat_hist_t const *hist, uint32_t total_us, uint32_t missed)
+{
+    char buf[160];
+    uint32_t bytes = BENCH_APPENDS * BENCH_PAYLOAD;
+    uint32_t rate = total_us ? (uint32_t) ((uint64_t) bytes * 1000000 / total_us) : 0;
+
+    int count = snprintf(buf, sizeof(buf), "%-8s %lu B/s  missed frames: %lu  ", name,
+                         (unsigned long) rate, (unsigned long) missed);
+    count += lat_hist_format(hist, &buf[count], sizeof(buf) - count);
+    tud_cdc_write(buf, count);
+    tud_cdc_write_flush();
+}
+
+static void cmd_logbench(void)
+{
+    static lat_hist_t hist;
+    uint8_t payload[BENCH_PAYLOAD];
+    memset(payload, 'x', sizeof(payload));
+
+    tud_cdc_write_str("\r\nBenchmarking, USB is not serviced meanwhile...\r\n");
+    tud_cdc_write_flush();
+
+    // LittleFS: write + sync of a scratch file, what every commit used to cost
+    lfs_file_t file;
+    if (lfs_file_open(&lfs, &file, "bench", LFS_O_WRONLY | LFS_O_CREAT | LFS_O_TRUNC) != LFS_ERR_OK) {
+        tud_cdc_write_str("Error\r\n");
+        return;
+    }
+
+    lat_hist_reset(&hist);
+    uint32_t missed = pio_usb_host_get_missed_frames();
+    uint32_t start = time_us_32();
+    for (uint32_t i = 0; i < BENCH_APPENDS; i++) {
+        uint32_t t = time_us_32();
+        lfs_file_write(&lfs, &file, payload, sizeof(payload));
+        lfs_file_sync(&lfs, &file);
+        lat_hist_add(&hist, time_us_32() - t);
+    }
+    uint32_t total_us = time_us_32() - start;
+    lfs_file_close(&lfs, &file);
+    lfs_remove(&lfs, "bench");
+    bench_report("littlefs", &hist, total_us, pio_usb_host_get_missed_frames() - missed);
+
+    // journal: append + sync, filler records are skipped by readers
+    lat_hist_reset(&hist);
+    missed = pio_usb_host_get_missed_frames();
+    start = time_us_32();
+    for (uint32_t i = 0; i < BENCH_APPENDS; i++) {
+        uint32_t t = time_us_32();
+        journal_append(JOURNAL_REC_BENCH, payload, sizeof(payload));
+        journal_flush();
+        lat_hist_add(&hist, time_us_32() - t);
+    }
+    total_us = time_us_32() - start;
+    bench_report("journal", &hist, total_us, pio_usb_host_get_missed_frames() - missed);
+}
+
+static void cmd_framestats(void)
+{
+    char buf[128];
+    int count = snprintf(buf, sizeof(buf),
+        "\r\nframes: %lu  missed: %lu  worst gap: %lu us  flash lockout: %s\r\n",
+        (unsigned long) pio_usb_host_get_frame_number(),
+        (unsigned long) pio_usb_host_get_missed_frames(),
+        (unsigned long) pio_usb_host_get_worst_frame_gap_us(),
+        RUN_FROM_RAM ? "off (running from RAM)" : "on");
+    tud_cdc_write(buf, count);
+}
+
+static void cmd_framereset(void)
+{
+    pio_usb_host_reset_frame_stats();
+    tud_cdc_write_str("\r\nDone\r\n");
+}
+
+static void cmd_flashstats(void)
+{
+    flash_sched_stats_t st;
+    flash_sched_get_stats(&st);
+
+    char buf[256];
+    int count = snprintf(buf, sizeof(buf),
+        "\r\nflash busy: %lu us/s  programs: %lu  erases: %lu  queued: %u  high water: %u/%u\r\n"
+        "program estimate: %lu us  worst program: %lu us  worst erase: %lu us\r\n"
+        "erases deferred: %lu  forced: %lu  errors: %lu\r\n",
+        (unsigned long) st.busy_us_per_sec, (unsigned long) st.programs,
+        (unsigned long) st.erases, st.queued, st.queue_high_water, FLASH_SCHED_QUEUE_SIZE,
+        (unsigned long) st.program_est_us, (unsigned long) st.worst_program_us,
+        (unsigned long) st.worst_erase_us, (unsigned long) st.erases_deferred,
+        (unsigned long) st.forced, (unsigned long) st.errors);
+    tud_cdc_write(buf, count);
+
+    maintenance_stats_t ms;
+    maintenance_get_stats(&ms);
+    journal_stats_t js;
+    journal_get_stats(&js);
+
+    count = snprintf(buf, sizeof(buf),
+        "maintenance: %s  runs: %lu  pre-erases: %lu  prepared: %u/%u\r\n"
+        "gc runs: %lu  errors: %lu  worst gc: %lu us\r\n",
+        maintenance_enabled() ? "on" : "off", (unsigned long) ms.runs,
+        (unsigned long) ms.pre_erases, js.segments_prepared, JOURNAL_PREPARE_SEGMENTS,
+        (unsigned long) ms.gc_runs, (unsigned long) ms.gc_errors, (unsigned long) ms.worst_gc_us);
+    tud_cdc_write(buf, count);
+}
+
+static void cmd_maintenance(void)
+{
+    maintenance_set_enabled(!maintenance_enabled());
+    tud_cdc_write_str(maintenance_enabled() ? "\r\nMaintenance on\r\n" : "\r\nMaintenance off\r\n");
+}
+
+static void cmd_eventstats(void)
+{
+    event_ring_stats_t st;
+    event_ring_get_stats(&st);
+
+    char buf[128];
+    int count = snprintf(buf, sizeof(buf),
+        "\r\nevents: %lu  overflows: %lu  high water: %u/%u  waiting: %u\r\n",
+        (unsigned long) st.pushed, (unsigned long) st.overflows,
+        st.high_water, EVENT_RING_SIZE, st.used);
+    tud_cdc_write(buf, count);
+}
+
+static void cmd_fwdstats(void)
+{
+    hid_forward_stats_t st;
+    hid_forward_get_stats(&st);
+
+    char buf[320];
+    int count = snprintf(buf, sizeof(buf),
+        "\r\nkeyboard sent: %lu  dropped: %lu  discarded: %lu  high water: %u/%u\r\n"
+        "mouse sent: %lu  coalesced: %lu  dropped: %lu  discarded: %lu  high water: %u/%u\r\n"
+        "control sent: %lu  dropped: %lu  discarded: %lu  notices dropped: %lu\r\n",
+        (unsigned long) st.kbd_forwarded, (unsigned long) st.kbd_dropped,
+        (unsigned long) st.kbd_discarded, st.kbd_high_water, HID_FORWARD_KBD_QUEUE_SIZE,
+        (unsigned long) st.mouse_forwarded, (unsigned long) st.mouse_coalesced,
+        (unsigned long) st.mouse_dropped, (unsigned long) st.mouse_discarded,
+        st.mouse_high_water, HID_FORWARD_MOUSE_QUEUE_SIZE,
+        (unsigned long) st.ctrl_forwarded, (unsigned long) st.ctrl_dropped,
+        (unsigned long) st.ctrl_discarded, (unsigned long) st.notices_dropped);
+    tud_cdc_write(buf, count);
+}
+
+static void cmd_latency(void)
+{
+    const char *names[FWD_CHANNEL_COUNT] = { "keyboard", "mouse", "control" };
+    char buf[128];
+
+    tud_cdc_write_str("\r\n");
+    for (uint8_t i = 0; i < FWD_CHANNEL_COUNT; i++) {
+        int count = snprintf(buf, sizeof(buf), "%-9s ", names[i]);
+        count += lat_hist_format(hid_forward_latency(i), &buf[count], sizeof(buf) - count);
+        tud_cdc_write(buf, count);
+    }
+
+    // journal_append() itself, and how long a queued page waits for flash
+    int count = snprintf(buf, sizeof(buf), "%-9s ", "append");
+    count += lat_hist_format(journal_append_latency(), &buf[count], sizeof(buf) - count);
+    tud_cdc_write(buf, count);
+
+    count = snprintf(buf, sizeof(buf), "%-9s ", "to flash");
+    count += lat_hist_format(flash_sched_program_latency(), &buf[count], sizeof(buf) - count);
+    tud_cdc_write(buf, count);
+}
+
+static void cmd_latencyreset(void)
+{
+    hid_forward_latency_reset();
+    journal_append_latency_reset();
+    flash_sched_program_latency_reset();
+    tud_cdc_write_str("\r\nDone\r\n");
+}
+
+static void cmd_dumpstats(void)
+{
+    log_dump_stats_t ds;
+    log_dump_get_stats(&ds);
+
+    // bytes per ms is KB/s
+    uint32_t const ms = ds.elapsed_us / 1000;
+    uint32_t const kb_per_s = ds.elapsed_us ? (uint32_t) ((uint64_t) ds.bytes * 1000 / ds.elapsed_us) : 0;
+
+    char buf[160];
+    int count = snprintf(buf, sizeof(buf),
+        "\r\n%s dump: %lu bytes, %lu records in %lu ms (%lu KB/s)  FIFO full: %lu  from %s%s\r\n",
+        ds.active ? "running" : "last", (unsigned long) ds.bytes, (unsigned long) ds.records,
+        (unsigned long) ms, (unsigned long) kb_per_s, (unsigned long) ds.fifo_full,
+        ds.from_cache ? "SRAM" : "flash", ds.aborted ? "  (aborted)" : "");
+    tud_cdc_write(buf, count);
+
+    log_proto_stats_t ps;
+    log_proto_get_stats(&ps);
+
+    count = snprintf(buf, sizeof(buf),
+        "binary: %lu frames in (%lu bad)  %lu chunks sent  %lu resent  %lu bytes\r\n",
+        (unsigned long) ps.frames_in, (unsigned long) ps.frames_bad, (unsigned long) ps.chunks_sent,
+        (unsigned long) ps.chunks_resent, (unsigned long) ps.bytes_sent);
+    tud_cdc_write(buf, count);
+
+#if CFG_TUD_MSC
+    msc_log_stats_t drive;
+    msc_log_get_stats(&drive);
+
+    // from the snapshot to the last read, which includes the host's own pauses
+    uint32_t const span_ms = drive.last_read_ms - drive.first_read_ms;
+    count = snprintf(buf, sizeof(buf),
+        "drive: %lu of %lu bytes read, %lu sectors in %lu ms (%lu KB/s)  busy %lu us\r\n",
+        (unsigned long) drive.data_bytes, (unsigned long) drive.file_size, (unsigned long) drive.sectors_read,
+        (unsigned long) span_ms, (unsigned long) (span_ms ? drive.data_bytes / span_ms : 0),
+        (unsigned long) drive.busy_us);
+    tud_cdc_write(buf, count);
+#endif
+}
+
+static void cmd_tail(const char *args)
+{
+    if (jobs_current()) {
+        tud_cdc_write_str("\r\nBusy, see 'jobs'\r\n");
+        return;
+    }
+
+    bool const binary = strcmp(args, "bin") == 0;
+    if (!binary && args[0]) {
+        tud_cdc_write_str("\r\nUsage: tail [bin]\r\n");
+        return;
+    }
+
+    tud_cdc_write_str("\r\nFollowing input, press any key to stop\r\n");
+    log_live_start(binary ? LOG_LIVE_BINARY : LOG_LIVE_TEXT);
+}
+
+static void tail_stop(void)
+{
+    log_live_stop();
+
+    log_live_stats_t ls;
+    log_live_get_stats(&ls);
+
+    // share of the time core0 spent on it, in hundredths of a percent
+    uint32_t const load = ls.elapsed_us ? (uint32_t) ((uint64_t) ls.busy_us * 10000 / ls.elapsed_us) : 0;
+
+    char buf[160];
+    int count = snprintf(buf, sizeof(buf),
+        "\r\ntail: %lu events  %lu dropped  %lu packets  %lu bytes  held back: %lu  core0: %lu.%02lu%%\r\n",
+        (unsigned long) ls.events, (unsigned long) ls.dropped, (unsigned long) ls.packets,
+        (unsigned long) ls.bytes, (unsigned long) ls.held_back, (unsigned long) (load / 100),
+        (unsigned long) (load % 100));
+    tud_cdc_write(buf, count);
+}
+
+static void cmd_binary(void)
+{
+    if (jobs_current()) {
+        tud_cdc_write_str("\r\nBusy, see 'jobs'\r\n");
+        return;
+    }
+
+    // the client skips this up to the first 0x00
+    tud_cdc_write_str("\r\nBinary mode\r\n");
+    log_proto_enter();
+}
+
 void check_command(char* cmd, uint8_t len)
 {
     // safe if len < buffer size
@@ -222,6 +795,9 @@ void check_command(char* cmd, uint8_t len)
     else if (strcmp(buf, "dumpstrings") == 0) {
         cmd_dumpstrings();
     }
+    else if (strncmp(buf, "dump ", 5) == 0) {
+        cmd_dump(&buf[5]);
+    }
     else if (strcmp(buf, "resetstrings") == 0) {
         cmd_resetstrings();
     }
@@ -231,6 +807,54 @@ void check_command(char* cmd, uint8_t len)
     else if (strcmp(buf, "resetfilesystem") == 0) {
         cmd_resetfilesystem();
     }
+    else if (strcmp(buf, "sync") == 0) {
+        cmd_sync();
+    }
+    else if (strcmp(buf, "logstats") == 0) {
+        cmd_logstats();
+    }
+    else if (strcmp(buf, "logbench") == 0) {
+        cmd_logbench();
+    }
+    else if (strcmp(buf, "eventstats") == 0) {
+        cmd_eventstats();
+    }
+    else if (strcmp(buf, "fwdstats") == 0) {
+        cmd_fwdstats();
+    }
+    else if (strcmp(buf, "latency") == 0) {
+        cmd_latency();
+    }
+    else if (strcmp(buf, "latencyreset") == 0) {
+        cmd_latencyreset();
+    }
+    else if (strcmp(buf, "framestats") == 0) {
+        cmd_framestats();
+    }
+    else if (strcmp(buf, "framereset") == 0) {
+        cmd_framereset();
+    }
+    else if (strcmp(buf, "flashstats") == 0) {
+        cmd_flashstats();
+    }
+    else if (strcmp(buf, "maintenance") == 0) {
+        cmd_maintenance();
+    }
+    else if (strcmp(buf, "dumpstats") == 0) {
+        cmd_dumpstats();
+    }
+    else if (strcmp(buf, "binary") == 0) {
+        cmd_binary();
+    }
+    else if (strcmp(buf, "tail") == 0 || strncmp(buf, "tail ", 5) == 0) {
+        cmd_tail(buf[4] ? &buf[5] : "");
+    }
+    else if (strcmp(buf, "jobs") == 0) {
+        cmd_jobs();
+    }
+    else if (strcmp(buf, "cancel") == 0) {
+        cmd_cancel();
+    }
     else {
         tud_cdc_write_str("\r\nUnknown command. Type 'help'\r\n");
     }
@@ -238,6 +862,12 @@ void check_command(char* cmd, uint8_t len)
 
 
 
+// Invoked when the device is configured by a host
+void tud_mount_cb(void)
+{
+  msc_log_mount();
+}
+
 // Invoked when CDC interface received data from host
 // Handles CLI input over USB CDC
 void tud_cdc_rx_cb(uint8_t itf)
@@ -250,6 +880,18 @@ void tud_cdc_rx_cb(uint8_t itf)
   uint8_t buf[32];  
   uint8_t count = tud_cdc_read(buf, sizeof(buf));
 
+  // frames, not command lines
+  if (log_proto_active()) {
+    log_proto_rx(buf, count);
+    return;
+  }
+
+  // any key ends the live view
+  if (log_live_active()) {
+    tail_stop();
+    return;
+  }
+
 
   // if newline, terminate string and print it
   if (buf[count-1] == '\r' || buf[count-1] == '\n') {
@@ -41,8 +41,10 @@
 #include "tusb.h"
 #include "usb_descriptors.h"
 #include "pico_lfs.h"
-
-#include "pico/util/queue.h"
+#include "event_ring.h"
+#include "hid_forward.h"
+#include "key_diff.h"
+#include "hid_report_map.h"
 
 
 
@@ -50,10 +52,17 @@
 // MACRO CONSTANT TYPEDEF PROTYPES
 //--------------------------------------------------------------------+
 
+// TinyUSB roothub port1 is the first pio-usb root port
+#define PIO_ROOT_IDX 0
+
+// length requested for a streamed report descriptor, the most wLength can
+// ask for; the device's short packet ends it earlier
+#define DESC_STREAM_MAX_LEN 0xFFFF
+
+static void desc_stream_task(void);
+static void release_mouse_buttons(uint8_t dev_addr, uint8_t instance);
 
 volatile bool core1_ready = false;
-static uint8_t const keycode2ascii[128][2] =  { HID_KEYCODE_TO_ASCII };
-extern queue_t keypress_queue;
 
 /*------------- MAIN -------------*/
 
@@ -61,8 +70,10 @@ extern queue_t keypress_queue;
 void core1_main() {
   sleep_ms(10);
 
+#if !RUN_FROM_RAM
   // need to allow this core to be paused by core0! Otherwise LFS won't work
   multicore_lockout_victim_init();
+#endif
   core1_ready = true;  
 
   // Use tuh_configure() to pass pio configuration to the host stack
@@ -89,6 +100,7 @@ void core1_main() {
 
   while (true) {
     tuh_task(); // tinyusb host task, process all data coming from keyboard
+    desc_stream_task();
   }
 }
 
@@ -96,16 +108,136 @@ void core1_main() {
 // Host HID
 //--------------------------------------------------------------------+
 
+//--------------------------------------------------------------------+
+// Streamed report descriptors
+//--------------------------------------------------------------------+
+
+// Descriptors larger than CFG_TUH_ENUMERATION_BUFSIZE are fetched once the
+// device is configured, with the pio-usb endpoint hook handing each packet of
+// the data stage straight to the field map parser, which never needs the
+// whole descriptor at once, so any size wLength can ask for fits.
+//
+// The hook is bound to the device's control endpoint before the request goes
+// out and stays there until the fetch completes; pio-usb only drops it when
+// the endpoint is closed, and then no more packets run on it. The transfer
+// buffer never sees data, a fetch whose bytes didn't all reach the parser
+// counts as failed.
+
+typedef struct {
+  uint8_t dev_addr;   // 0 = free
+  uint8_t instance;
+} desc_stream_req_t;
+
+static desc_stream_req_t desc_stream_queue_[CFG_TUH_HID];
+static volatile bool desc_stream_busy;
+
+// the data stage lands in the hook, this only has to exist
+static uint8_t desc_stream_scratch[64];
+
+static void desc_stream_queue(uint8_t dev_addr, uint8_t instance)
+{
+  for (uint8_t i = 0; i < CFG_TUH_HID; i++) {
+    if (desc_stream_queue_[i].dev_addr == 0) {
+      desc_stream_queue_[i].dev_addr = dev_addr;
+      desc_stream_queue_[i].instance = instance;
+      return;
+    }
+  }
+  hid_forward_notice("Error: report descriptor stream queue full\r\n");
+}
+
+static void desc_stream_dequeue(uint8_t dev_addr, uint8_t instance)
+{
+  for (uint8_t i = 0; i < CFG_TUH_HID; i++) {
+    if (desc_stream_queue_[i].dev_addr == dev_addr && desc_stream_queue_[i].instance == instance) {
+      desc_stream_queue_[i].dev_addr = 0;
+    }
+  }
+}
+
+static void __not_in_flash_func(desc_stream_rx)(uint8_t const *data, uint16_t len, void *arg)
+{
+  (void) arg;
+  hid_map_stream_feed(data, len);
+}
+
+static void desc_stream_complete(tuh_xfer_t *xfer)
+{
+  uint8_t const dev_addr = xfer->daddr;
+  uint8_t const instance = (uint8_t) xfer->user_data;
+
+  pio_usb_host_endpoint_set_rx_stream(PIO_ROOT_IDX, dev_addr, 0x80, NULL, NULL);
+
+  if (xfer->result != XFER_RESULT_SUCCESS || hid_map_stream_bytes() != xfer->actual_len)
+  {
+    hid_map_stream_abort();
+    hid_forward_notice("[%u] HID Interface%u, report descriptor fetch failed\r\n", dev_addr, instance);
+  }
+  else
+  {
+    uint32_t const bytes = hid_map_stream_bytes();
+    hid_report_map_t const *map = hid_map_stream_end();
+
+    hid_forward_notice("[%u] HID Interface%u, streamed %lu byte report descriptor, %u mapped fields\r\n",
+                       dev_addr, instance, bytes, map ? map->n_fields : 0);
+
+    if (map && !tuh_hid_receive_report(dev_addr, instance))
+    {
+      hid_forward_notice("Error: cannot request report\r\n");
+    }
+  }
+
+  desc_stream_busy = false;
+}
+
+// start the next queued fetch once the control pipe is free, retried every loop
+static void desc_stream_task(void)
+{
+  if (desc_stream_busy) return;
+
+  for (uint8_t i = 0; i < CFG_TUH_HID; i++) {
+    desc_stream_req_t const req = desc_stream_queue_[i];
+    if (req.dev_addr == 0 || !tuh_mounted(req.dev_addr)) continue;
+
+    tuh_itf_info_t info;
+    if (!tuh_hid_itf_get_info(req.dev_addr, req.instance, &info) ||
+        !hid_map_stream_begin(req.dev_addr, req.instance))
+    {
+      desc_stream_queue_[i].dev_addr = 0;
+      continue;
+    }
+
+    if (!pio_usb_host_endpoint_set_rx_stream(PIO_ROOT_IDX, req.dev_addr, 0x80, desc_stream_rx, NULL))
+    {
+      hid_map_stream_abort();
+      desc_stream_queue_[i].dev_addr = 0;
+      continue;
+    }
+
+    desc_stream_busy = true;
+    if (!tuh_descriptor_get_hid_report(req.dev_addr, info.desc.bInterfaceNumber, HID_DESC_TYPE_REPORT, 0,
+                                       desc_stream_scratch, DESC_STREAM_MAX_LEN, desc_stream_complete,
+                                       req.instance))
+    {
+      // control pipe still busy with enumeration, try again next time round
+      pio_usb_host_endpoint_set_rx_stream(PIO_ROOT_IDX, req.dev_addr, 0x80, NULL, NULL);
+      hid_map_stream_abort();
+      desc_stream_busy = false;
+      return;
+    }
+
+    desc_stream_queue_[i].dev_addr = 0;
+    return;
+  }
+}
+
 // Invoked when device with hid interface is mounted
-// Report descriptor is also available for use. tuh_hid_parse_report_descriptor()
-// can be used to parse common/simple enough descriptor.
+// Interfaces running the boot protocol are decoded with the fixed boot layout,
+// everything else gets its report descriptor parsed into a field map here.
 // Note: if report descriptor length > CFG_TUH_ENUMERATION_BUFSIZE, it will be skipped
-// therefore report_desc = NULL, desc_len = 0
+// therefore report_desc = NULL, desc_len = 0, such descriptors are streamed later
 void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t instance, uint8_t const* desc_report, uint16_t desc_len)
 {
-  (void)desc_report;
-  (void)desc_len;
-
   // Interface protocol (hid_interface_protocol_enum_t)
   const char* protocol_str[] = { "None", "Keyboard", "Mouse" };
   uint8_t const itf_protocol = tuh_hid_interface_protocol(dev_addr, instance);
@@ -113,19 +245,29 @@ void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t instance, uint8_t const* desc_re
   uint16_t vid, pid;
   tuh_vid_pid_get(dev_addr, &vid, &pid);
 
-  char tempbuf[256];
-  int count = sprintf(tempbuf, "[%04x:%04x][%u] HID Interface%u, Protocol = %s\r\n", vid, pid, dev_addr, instance, protocol_str[itf_protocol]);
+  bool const is_boot = (itf_protocol == HID_ITF_PROTOCOL_KEYBOARD || itf_protocol == HID_ITF_PROTOCOL_MOUSE) &&
+                       tuh_hid_get_protocol(dev_addr, instance) == HID_PROTOCOL_BOOT;
+
+  if (!is_boot && desc_report == NULL)
+  {
+    hid_forward_notice("[%04x:%04x][%u] HID Interface%u, Protocol = %s, report descriptor queued for streaming\r\n",
+                       vid, pid, dev_addr, instance, protocol_str[itf_protocol]);
+    desc_stream_queue(dev_addr, instance);
+    return;
+  }
+
+  hid_report_map_t const *map = is_boot ? NULL : hid_map_parse(dev_addr, instance, desc_report, desc_len);
 
-  tud_cdc_write(tempbuf, count);
-  tud_cdc_write_flush();
+  hid_forward_notice("[%04x:%04x][%u] HID Interface%u, Protocol = %s, %u mapped fields\r\n", vid, pid, dev_addr, instance,
+                     protocol_str[itf_protocol], map ? map->n_fields : 0);
 
-  // Receive report from boot keyboard & mouse only
+  // Receive report from boot keyboard & mouse, and anything with a usable field map
   // tuh_hid_report_received_cb() will be invoked when report is available
-  if (itf_protocol == HID_ITF_PROTOCOL_KEYBOARD || itf_protocol == HID_ITF_PROTOCOL_MOUSE)
+  if (is_boot || map)
   {
     if ( !tuh_hid_receive_report(dev_addr, instance) )
     {
-      tud_cdc_write_str("Error: cannot request report\r\n");
+      hid_forward_notice("Error: cannot request report\r\n");
     }
   }
 }
@@ -133,92 +275,121 @@ void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t instance, uint8_t const* desc_re
 // Invoked when device with hid interface is un-mounted
 void tuh_hid_umount_cb(uint8_t dev_addr, uint8_t instance)
 {
-  char tempbuf[256];
-  int count = sprintf(tempbuf, "[%u] HID Interface%u is unmounted\r\n", dev_addr, instance);
-  tud_cdc_write(tempbuf, count);
-  tud_cdc_write_flush();
+  desc_stream_dequeue(dev_addr, instance);
+  hid_forward_release(dev_addr, instance);
+  key_diff_release(dev_addr, instance);
+  release_mouse_buttons(dev_addr, instance);
+  hid_map_release(dev_addr, instance);
+  hid_forward_notice("[%u] HID Interface%u is unmounted\r\n", dev_addr, instance);
 }
 
-// look up new key in previous keys
-static inline bool find_key_in_report(hid_keyboard_report_t const *report, uint8_t keycode)
+// forward the report and log every key press and release it contains
+static void process_kbd_report(uint8_t dev_addr, uint8_t instance, hid_keyboard_report_t const *report, uint32_t time_us)
 {
-  for(uint8_t i=0; i<6; i++)
-  {
-    if (report->keycode[i] == keycode)  return true;
-  }
+  // hand the report to core0, which sends it to the real host
+  hid_forward_keyboard(dev_addr, instance, report, time_us);
 
-  return false;
+  // per-interface bitmap diff, emits KEY_DOWN / KEY_UP events to core0
+  key_bitmap_t now;
+  if (key_bitmap_from_boot(&now, report)) {
+    key_diff_process(dev_addr, instance, &now, time_us);
+  }
 }
 
+// last button state per mouse interface, changes are logged like keys
+typedef struct {
+  uint8_t dev_addr;   // 0 = free
+  uint8_t instance;
+  uint8_t buttons;
+} mouse_state_t;
+
+static mouse_state_t mouse_state[CFG_TUH_HID];
 
-// convert hid keycode to ascii and print via usb device CDC (ignore non-printable)
-static void process_kbd_report(uint8_t dev_addr, hid_keyboard_report_t const *report)
+static void log_mouse_buttons(uint8_t dev_addr, uint8_t instance, uint8_t buttons, uint32_t time_us)
 {
-  (void) dev_addr;
-  static hid_keyboard_report_t prev_report = { 0, 0, {0} }; // previous report to check key released
-  bool flush = false;
-
-  // send keyboard report data to real host, via tud task (which is in core0)
-  tud_hid_keyboard_report(REPORT_ID_KEYBOARD, report->modifier, (uint8_t*) report->keycode);
-  
-  for(uint8_t i=0; i<6; i++)
-  {
-    uint8_t keycode = report->keycode[i];
-    if ( keycode )
-    {
-      if ( find_key_in_report(&prev_report, keycode) )
-      {
-        // exist in previous report means the current key is holding
-      }else
-      {
-        // not existed in previous report means the current key is pressed
-
-        bool const is_shift = report->modifier & (KEYBOARD_MODIFIER_LEFTSHIFT | KEYBOARD_MODIFIER_RIGHTSHIFT);
-        uint8_t ch = keycode2ascii[keycode][is_shift ? 1 : 0];
-
-        if (ch)
-        {
-          queue_try_add(&keypress_queue, &ch);
-          if (ch == '\n') tud_cdc_write("\r", 1);
-          // also, write to cdc for logging, which will be sent in core0
-          //tud_cdc_write(&ch, 1);
-          flush = true;
-
-        }
-      }
+  mouse_state_t *state = NULL;
+
+  for (uint8_t i = 0; i < CFG_TUH_HID; i++) {
+    mouse_state_t *m = &mouse_state[i];
+    if (m->dev_addr == dev_addr && m->instance == instance) {
+      state = m;
+      break;
+    }
+    if (!state && m->dev_addr == 0) state = m;
+  }
+  if (!state) return;
+
+  if (state->dev_addr != dev_addr || state->instance != instance) {
+    state->dev_addr = dev_addr;
+    state->instance = instance;
+    state->buttons = 0;
+  }
+  if (state->buttons == buttons) return;
+  state->buttons = buttons;
+
+  input_event_t const ev = {
+    .time_us = time_us,
+    .dev_addr = dev_addr,
+    .instance = instance,
+    .type = EVENT_MOUSE_BUTTONS,
+    .keycode = buttons,
+  };
+  event_ring_push(&ev, 1);
+}
+
+static void release_mouse_buttons(uint8_t dev_addr, uint8_t instance)
+{
+  for (uint8_t i = 0; i < CFG_TUH_HID; i++) {
+    if (mouse_state[i].dev_addr == dev_addr && mouse_state[i].instance == instance) {
+      mouse_state[i].dev_addr = 0;
     }
-    // TODO example skips key released
   }
+}
 
-  if (flush) tud_cdc_write_flush();
+// hand a boot mouse report to core0, which sums the motion of reports that
+// queue up and sends the buttons in order
+static void process_mouse_report(uint8_t dev_addr, uint8_t instance, uint8_t const *report, uint16_t len, uint32_t time_us)
+{
+  // boot mice send buttons, x, y and maybe a wheel byte, the rest stays 0
+  hid_mouse_report_t mouse = { 0 };
+  memcpy(&mouse, report, len < 4 ? len : 4);
 
-  prev_report = *report;
+  hid_forward_mouse(dev_addr, instance, &mouse, time_us);
+  log_mouse_buttons(dev_addr, instance, mouse.buttons, time_us);
 }
 
-// send mouse report to usb device CDC
-static void process_mouse_report(uint8_t dev_addr, hid_mouse_report_t const * report)
+// decode a non-boot report through the field map built at mount
+static void process_mapped_report(uint8_t dev_addr, uint8_t instance, hid_report_map_t const *map,
+                                  uint8_t const *report, uint16_t len, uint32_t time_us)
 {
-  tud_hid_mouse_report(REPORT_ID_MOUSE, report->buttons, report->x, report->y, report->wheel, 0);
+  hid_input_t input;
+  if (!hid_map_extract(map, report, len, &input)) return;
+
+  if (input.has_keys && key_diff_process(dev_addr, instance, &input.keys, time_us)) {
+    // the real host only sees our boot-compatible keyboard, squeeze the state into 6KRO
+    hid_keyboard_report_t kbd;
+    key_bitmap_to_boot(&input.keys, &kbd);
+    hid_forward_keyboard(dev_addr, instance, &kbd, time_us);
+  }
 
-  //------------- button state  -------------//
-  //uint8_t button_changed_mask = report->buttons ^ prev_report.buttons;
-  char l = report->buttons & MOUSE_BUTTON_LEFT   ? 'L' : '-';
-  char m = report->buttons & MOUSE_BUTTON_MIDDLE ? 'M' : '-';
-  char r = report->buttons & MOUSE_BUTTON_RIGHT  ? 'R' : '-';
-  char f = report->buttons & MOUSE_BUTTON_FORWARD  ? 'F' : '-';
-  char b = report->buttons & MOUSE_BUTTON_BACKWARD  ? 'B' : '-';
+  if (input.has_mouse) {
+    hid_forward_mouse(dev_addr, instance, &input.mouse, time_us);
+    log_mouse_buttons(dev_addr, instance, input.mouse.buttons, time_us);
+  }
 
-  char tempbuf[32];
-  int count = sprintf(tempbuf, "[%u] %c%c%c%c%c %d %d %d\r\n", dev_addr, l, m, r, f, b, report->x, report->y, report->wheel);
+  if (input.has_consumer) {
+    hid_forward_consumer(dev_addr, instance, input.consumer, time_us);
+  }
 
-  tud_cdc_write(tempbuf, count);
-  tud_cdc_write_flush();
+  if (input.has_gamepad) {
+    hid_forward_gamepad(dev_addr, instance, &input.gamepad, time_us);
+  }
 }
 
 // Invoked when received report from device via interrupt endpoint
 void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t instance, uint8_t const* report, uint16_t len)
 {
-  (void) len;
+  uint32_t const time_us = time_us_32();
   uint8_t const itf_protocol = tuh_hid_interface_protocol(dev_addr, instance);
 
   // Print raw report bytes for debugging
@@ -232,14 +403,19 @@ void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t instance, uint8_t cons
   tud_cdc_write(raw_report_buf, strlen(raw_report_buf));
   tud_cdc_write_flush();*/
 
-  switch(itf_protocol)
+  hid_report_map_t const *map = hid_map_find(dev_addr, instance);
+  if (map)
+  {
+    process_mapped_report(dev_addr, instance, map, report, len, time_us);
+  }
+  else switch(itf_protocol)
   {
     case HID_ITF_PROTOCOL_KEYBOARD:
-      process_kbd_report(dev_addr, (hid_keyboard_report_t const*) report );
+      process_kbd_report(dev_addr, instance, (hid_keyboard_report_t const*) report, time_us );
     break;
 
     case HID_ITF_PROTOCOL_MOUSE:
-      process_mouse_report(dev_addr, (hid_mouse_report_t const*) report );
+      process_mouse_report(dev_addr, instance, report, len, time_us );
     break;
 
     default: break;
@@ -248,6 +424,6 @@ void tuh_hid_report_received_cb(uint8_t dev_addr, uint8_t instance, uint8_t cons
   // continue to request to receive report
   if ( !tuh_hid_receive_report(dev_addr, instance) )
   {
-    tud_cdc_write_str("Error: cannot request report\r\n");
+    hid_forward_notice("Error: cannot request report\r\n");
   }
 }
\ No newline at end of file
@@ -0,0 +1,59 @@
+#include "pico/stdlib.h"
+
+#include "maintenance.h"
+#include "flash_sched.h"
+#include "journal.h"
+
+static lfs_t *m_lfs;
+static bool enabled = true;
+static uint32_t last_run_ms = 0;
+static uint32_t last_gc_ms = 0;
+
+static maintenance_stats_t stats;
+
+void maintenance_init(lfs_t *lfs)
+{
+  m_lfs = lfs;
+  last_gc_ms = to_ms_since_boot(get_absolute_time());
+}
+
+void maintenance_task(void)
+{
+  if (!enabled || flash_sched_quiet_ms() < MAINTENANCE_QUIET_MS) return;
+
+  uint32_t now = to_ms_since_boot(get_absolute_time());
+  if (now - last_run_ms < MAINTENANCE_INTERVAL_MS) return;
+  last_run_ms = now;
+  stats.runs++;
+
+  // only queued here, the scheduler runs them while it stays quiet
+  stats.pre_erases += journal_prepare();
+
+  // LittleFS flash access can't be scheduled, so gc runs inline and rarely
+  if (m_lfs && now - last_gc_ms >= MAINTENANCE_GC_INTERVAL_MS) {
+    last_gc_ms = now;
+
+    uint32_t start = time_us_32();
+    int err = lfs_fs_gc(m_lfs);
+    uint32_t elapsed = time_us_32() - start;
+
+    stats.gc_runs++;
+    if (err != LFS_ERR_OK) stats.gc_errors++;
+    if (elapsed > stats.worst_gc_us) stats.worst_gc_us = elapsed;
+  }
+}
+
+void maintenance_set_enabled(bool on)
+{
+  enabled = on;
+}
+
+bool maintenance_enabled(void)
+{
+  return enabled;
+}
+
+void maintenance_get_stats(maintenance_stats_t *out)
+{
+  *out = stats;
+}
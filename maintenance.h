@@ -0,0 +1,47 @@
+#ifndef MAINTENANCE_H_
+#define MAINTENANCE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "lfs.h"
+
+// Flash housekeeping done while nobody is typing, so the work doesn't land in
+// the middle of a burst: pre-erasing journal segments and LittleFS garbage
+// collection.
+
+// input must have been quiet this long
+#ifndef MAINTENANCE_QUIET_MS
+#define MAINTENANCE_QUIET_MS 500
+#endif
+
+// how often to look for journal segments to pre-erase
+#ifndef MAINTENANCE_INTERVAL_MS
+#define MAINTENANCE_INTERVAL_MS 1000
+#endif
+
+// how often to run lfs_fs_gc()
+#ifndef MAINTENANCE_GC_INTERVAL_MS
+#define MAINTENANCE_GC_INTERVAL_MS 60000
+#endif
+
+typedef struct {
+  uint32_t runs;
+  uint32_t pre_erases;        // journal segment erases queued
+  uint32_t gc_runs;
+  uint32_t gc_errors;
+  uint32_t worst_gc_us;
+} maintenance_stats_t;
+
+void maintenance_init(lfs_t *lfs);
+
+// call from the core0 loop
+void maintenance_task(void);
+
+// on by default, off to compare latencies without it
+void maintenance_set_enabled(bool enabled);
+bool maintenance_enabled(void);
+
+void maintenance_get_stats(maintenance_stats_t *stats);
+
+#endif /* MAINTENANCE_H_ */
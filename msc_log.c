@@ -0,0 +1,305 @@
+#include <assert.h>
+#include <string.h>
+
+#include "pico/stdlib.h"
+#include "tusb.h"
+
+#include "flash_sched.h"
+#include "journal.h"
+#include "log_writer.h"
+#include "msc_log.h"
+
+#if CFG_TUD_MSC
+
+// One FAT, one root directory sector and one sector per cluster, sized for
+// the whole journal region: the layout of a small floppy, which every host
+// mounts.
+#define SECTOR_SIZE     512
+#define DATA_SECTORS    (JOURNAL_SIZE / SECTOR_SIZE)
+#define FAT_SECTORS     (((DATA_SECTORS + 2) * 3 / 2 + SECTOR_SIZE - 1) / SECTOR_SIZE)
+#define ROOT_ENTRIES    16
+
+#define LBA_FAT         1
+#define LBA_ROOT        (LBA_FAT + FAT_SECTORS)
+#define LBA_DATA        (LBA_ROOT + 1)
+#define TOTAL_SECTORS   (LBA_DATA + DATA_SECTORS)
+
+#define FAT12_EOC       0xFFF
+
+static_assert(ROOT_ENTRIES * 32 == SECTOR_SIZE, "the root directory is one sector");
+static_assert(TOTAL_SECTORS < 0x10000, "total sector count must fit the 16-bit field");
+
+static uint32_t file_start;     // log offset of the first byte
+static uint32_t file_size;
+static bool snapshot_due = true;
+static msc_log_stats_t stats;
+
+static void put_u16(uint8_t *p, uint16_t v)
+{
+  p[0] = (uint8_t) v;
+  p[1] = (uint8_t) (v >> 8);
+}
+
+static void put_u32(uint8_t *p, uint32_t v)
+{
+  put_u16(p, (uint16_t) v);
+  put_u16(p + 2, (uint16_t) (v >> 16));
+}
+
+// what the host sees of the log is fixed once per USB mount, whatever it
+// reads again later
+static void take_snapshot(void)
+{
+  uint32_t end;
+
+  snapshot_due = false;
+  journal_extent(&file_start, &end);
+  file_size = end - file_start;
+
+  memset(&stats, 0, sizeof(stats));
+  stats.file_size = file_size;
+  stats.first_read_ms = to_ms_since_boot(get_absolute_time());
+}
+
+static void boot_sector(uint8_t *s)
+{
+  static uint8_t const jump[] = { 0xEB, 0x3C, 0x90 };
+
+  memcpy(&s[0], jump, sizeof(jump));
+  memcpy(&s[3], "MSWIN4.1", 8);
+  put_u16(&s[11], SECTOR_SIZE);
+  s[13] = 1;                          // sectors per cluster
+  put_u16(&s[14], 1);                 // reserved sectors, this one
+  s[16] = 1;                          // FATs
+  put_u16(&s[17], ROOT_ENTRIES);
+  put_u16(&s[19], TOTAL_SECTORS);
+  s[21] = 0xF8;                       // fixed media
+  put_u16(&s[22], FAT_SECTORS);
+  put_u16(&s[24], 1);                 // sectors per track
+  put_u16(&s[26], 1);                 // heads
+  s[36] = 0x80;                       // drive number
+  s[38] = 0x29;                       // extended boot signature
+  put_u32(&s[39], 0x4C4E524A);        // volume id
+  memcpy(&s[43], "KEYLOG     ", 11);
+  memcpy(&s[54], "FAT12   ", 8);
+  s[510] = 0x55;
+  s[511] = 0xAA;
+}
+
+// FAT12 entry k: the file is one run of clusters from 2
+static uint16_t fat_entry(uint32_t k)
+{
+  uint32_t const clusters = (file_size + SECTOR_SIZE - 1) / SECTOR_SIZE;
+
+  if (k == 0) return 0xFF8;
+  if (k == 1) return FAT12_EOC;
+  if (k < 2 || k >= 2 + clusters) return 0;
+  return k + 1 == 2 + clusters ? FAT12_EOC : (uint16_t) (k + 1);
+}
+
+static void fat_sector(uint32_t index, uint8_t *s)
+{
+  // entries are 12 bits, two share three bytes; take every entry touching
+  // this sector and keep the bytes that fall inside it
+  uint32_t const base = index * SECTOR_SIZE;
+  uint32_t const first = base * 2 / 3;
+  uint32_t const last = (base + SECTOR_SIZE) * 2 / 3 + 1;
+
+  for (uint32_t k = first ? first - 1 : 0; k <= last; k++) {
+    uint16_t const v = fat_entry(k);
+    uint32_t const at = k + k / 2;
+    uint8_t lo, hi;
+
+    if (k & 1) {
+      lo = (uint8_t) ((v << 4) & 0xF0);
+      hi = (uint8_t) (v >> 4);
+    } else {
+      lo = (uint8_t) v;
+      hi = (uint8_t) ((v >> 8) & 0x0F);
+    }
+    if (at >= base && at < base + SECTOR_SIZE) s[at - base] |= lo;
+    if (at + 1 >= base && at + 1 < base + SECTOR_SIZE) s[at + 1 - base] |= hi;
+  }
+}
+
+static void root_sector(uint8_t *s)
+{
+  // volume label
+  memcpy(&s[0], "KEYLOG     ", 11);
+  s[11] = 0x08;
+
+  uint8_t *e = &s[32];
+  memcpy(&e[0], "JOURNAL BIN", 11);
+  e[11] = 0x01;                       // read-only
+  put_u16(&e[26], file_size ? 2 : 0); // first cluster
+  put_u32(&e[28], file_size);
+}
+
+// bytes of JOURNAL.BIN from pos, straight from flash
+static void data_bytes(uint32_t pos, uint8_t *buf, uint32_t len)
+{
+  while (len) {
+    if (pos >= file_size) {
+      memset(buf, 0, len);
+      return;
+    }
+
+    uint32_t n = len < file_size - pos ? len : file_size - pos;
+    int got = journal_read_raw(file_start + pos, buf, (uint16_t) n);
+    if (got <= 0) {
+      // evicted since the snapshot
+      memset(buf, 0, n);
+      got = (int) n;
+    }
+
+    stats.data_bytes += (uint32_t) got;
+    pos += (uint32_t) got;
+    buf += got;
+    len -= (uint32_t) got;
+  }
+}
+
+static void read_sector(uint32_t lba, uint32_t offset, uint8_t *buf, uint32_t len)
+{
+  if (lba >= LBA_DATA) {
+    data_bytes((lba - LBA_DATA) * SECTOR_SIZE + offset, buf, len);
+    return;
+  }
+
+  // metadata sectors are made up whole, only a few are ever read
+  static uint8_t s[SECTOR_SIZE];
+  memset(s, 0, sizeof(s));
+
+  if (lba == 0) {
+    boot_sector(s);
+  } else if (lba < LBA_ROOT) {
+    fat_sector(lba - LBA_FAT, s);
+  } else {
+    root_sector(s);
+  }
+  memcpy(buf, &s[offset], len);
+}
+
+//--------------------------------------------------------------------+
+// TinyUSB MSC callbacks
+//--------------------------------------------------------------------+
+
+void tud_msc_inquiry_cb(uint8_t lun, uint8_t vendor_id[8], uint8_t product_id[16], uint8_t product_rev[4])
+{
+  (void) lun;
+
+  memcpy(vendor_id, "TinyUSB ", 8);
+  memcpy(product_id, "Log             ", 16);
+  memcpy(product_rev, "1.0 ", 4);
+}
+
+bool tud_msc_test_unit_ready_cb(uint8_t lun)
+{
+  if (snapshot_due) {
+    // not ready until flash_sched has programmed what msc_log_mount()
+    // committed, hosts keep asking
+    flash_sched_stats_t fs;
+    flash_sched_get_stats(&fs);
+    if (fs.queued) {
+      tud_msc_set_sense(lun, SCSI_SENSE_NOT_READY, 0x04, 0x01);
+      return false;
+    }
+    take_snapshot();
+  }
+  return true;
+}
+
+void tud_msc_capacity_cb(uint8_t lun, uint32_t *block_count, uint16_t *block_size)
+{
+  (void) lun;
+
+  *block_count = TOTAL_SECTORS;
+  *block_size = SECTOR_SIZE;
+}
+
+bool tud_msc_start_stop_cb(uint8_t lun, uint8_t power_condition, bool start, bool load_eject)
+{
+  (void) lun;
+  (void) power_condition;
+  (void) start;
+  (void) load_eject;
+  return true;
+}
+
+bool tud_msc_is_writable_cb(uint8_t lun)
+{
+  (void) lun;
+  return false;
+}
+
+int32_t tud_msc_read10_cb(uint8_t lun, uint32_t lba, uint32_t offset, void *buffer, uint32_t bufsize)
+{
+  (void) lun;
+
+  if (lba >= TOTAL_SECTORS) return -1;
+
+  uint32_t const start = time_us_32();
+  // read without asking first, it gets what is in flash
+  if (snapshot_due) take_snapshot();
+
+  uint8_t *buf = buffer;
+  uint32_t left = bufsize;
+
+  while (left) {
+    uint32_t n = SECTOR_SIZE - offset < left ? SECTOR_SIZE - offset : left;
+    read_sector(lba, offset, buf, n);
+    buf += n;
+    left -= n;
+    lba++;
+    offset = 0;
+    stats.sectors_read++;
+  }
+
+  stats.busy_us += time_us_32() - start;
+  stats.last_read_ms = to_ms_since_boot(get_absolute_time());
+  return (int32_t) bufsize;
+}
+
+int32_t tud_msc_write10_cb(uint8_t lun, uint32_t lba, uint32_t offset, uint8_t *buffer, uint32_t bufsize)
+{
+  (void) lun;
+  (void) lba;
+  (void) offset;
+  (void) buffer;
+  (void) bufsize;
+
+  // the volume is read-only
+  tud_msc_set_sense(lun, SCSI_SENSE_DATA_PROTECT, 0x27, 0x00);
+  return -1;
+}
+
+int32_t tud_msc_scsi_cb(uint8_t lun, uint8_t const scsi_cmd[16], void *buffer, uint16_t bufsize)
+{
+  (void) buffer;
+  (void) bufsize;
+
+  if (scsi_cmd[0] == SCSI_CMD_PREVENT_ALLOW_MEDIUM_REMOVAL) return 0;
+
+  tud_msc_set_sense(lun, SCSI_SENSE_ILLEGAL_REQUEST, 0x20, 0x00);
+  return -1;
+}
+
+#endif /* CFG_TUD_MSC */
+
+void msc_log_mount(void)
+{
+#if CFG_TUD_MSC
+  // only queued here, this runs inside tud_task()
+  log_writer_commit();
+  snapshot_due = true;
+#endif
+}
+
+void msc_log_get_stats(msc_log_stats_t *out)
+{
+#if CFG_TUD_MSC
+  *out = stats;
+#else
+  memset(out, 0, sizeof(*out));
+#endif
+}
@@ -0,0 +1,34 @@
+#ifndef MSC_LOG_H_
+#define MSC_LOG_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Read-only USB mass storage view of the log (USB_MSC_LOG, CDC configuration
+// only). The volume is a FAT12 image made up sector by sector as the host
+// reads it, with one file, JOURNAL.BIN: the raw journal from its oldest
+// segment to what is in flash, laid out as described in journal.c (log
+// offset journal_extent() start is file offset 0). Nothing of it is kept in
+// RAM; data sectors come straight from journal_read_raw().
+//
+// The file's extent is taken once per USB mount, when the host first finds
+// the unit ready, after what was staged has reached flash; re-plug to see
+// what was logged since. Segments evicted while the host is still copying
+// read as zeros.
+
+// since the last snapshot
+typedef struct {
+  uint32_t sectors_read;
+  uint32_t data_bytes;    // of JOURNAL.BIN
+  uint32_t busy_us;       // spent making up sectors
+  uint32_t first_read_ms; // when the snapshot was taken
+  uint32_t last_read_ms;
+  uint32_t file_size;
+} msc_log_stats_t;
+
+// the device was configured by a host, take a new snapshot for it
+void msc_log_mount(void);
+
+void msc_log_get_stats(msc_log_stats_t *stats);
+
+#endif /* MSC_LOG_H_ */
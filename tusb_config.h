@@ -71,23 +71,57 @@
 
 //------------- CLASS -------------//
 #define CFG_TUD_CDC              1
-#define CFG_TUD_HID               1
 
-// CDC FIFO size of TX and RX
+// Keyboard and mouse each get their own HID interface and IN endpoint, so one
+// never waits behind the other. 0 puts both on one composite interface.
+#ifndef USB_HID_SPLIT_INTERFACES
+#define USB_HID_SPLIT_INTERFACES  1
+#endif
+
+#define CFG_TUD_HID               (USB_HID_SPLIT_INTERFACES ? 2 : 1)
+
+// bInterval of the HID IN endpoints, in ms at full speed
+#ifndef USB_HID_POLL_INTERVAL_MS
+#define USB_HID_POLL_INTERVAL_MS  1
+#endif
+
+// CDC FIFO size of TX and RX; log dumps refill the TX FIFO once per loop,
+// so a bigger one keeps the endpoint busy for longer in between
+#ifndef CFG_TUD_CDC_RX_BUFSIZE
 #define CFG_TUD_CDC_RX_BUFSIZE   256
-#define CFG_TUD_CDC_TX_BUFSIZE   256
+#endif
+#ifndef CFG_TUD_CDC_TX_BUFSIZE
+#define CFG_TUD_CDC_TX_BUFSIZE   1024
+#endif
 
 // CDC Endpoint transfer buffer size, more is faster
+#ifndef CFG_TUD_CDC_EP_BUFSIZE
 #define CFG_TUD_CDC_EP_BUFSIZE   64
+#endif
 
 
 #define CFG_TUD_HID_EP_BUFSIZE    16
 
+// Read-only mass storage view of the log next to CDC, see msc_log.h
+#ifndef USB_MSC_LOG
+#define USB_MSC_LOG               0
+#endif
+
+#define CFG_TUD_MSC               USB_MSC_LOG
+
+// MSC buffer, one sector per read callback
+#define CFG_TUD_MSC_EP_BUFSIZE    512
+
 //--------------------------------------------------------------------
 // HOST CONFIGURATION
 //--------------------------------------------------------------------
 
 // Size of buffer to hold descriptors and other data used for enumeration
+// HID report descriptors that don't fit are streamed into the field map parser
+// after mount (see main_host.c) instead of raising this: 1 KB here would cost
+// another 768 B of SRAM and still cap the size. The stream needs ~100 B of
+// parser state and a 64 B transfer buffer that no data reaches, whatever the
+// length up to the 64 KB wLength allows.
 #define CFG_TUH_ENUMERATION_BUFSIZE 256
 
 #define CFG_TUH_HUB                 1
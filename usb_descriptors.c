@@ -26,14 +26,18 @@
 
 #include "tusb.h"
 #include "usb_descriptors.h"
+#include "hid_forward.h"
 
 /* A combination of interfaces must have a unique product id, since PC will save device driver after the first plug.
  * Same VID/PID with different interface e.g MSC (first), then CDC (later) will possibly cause system error on PC.
  *
  * Auto ProductID layout's Bitmap:
  *   [MSB]         HID | MSC | CDC          [LSB]
+ *
+ * Each bit only says whether the class is there; CFG_TUD_HID counts instances
+ * and would otherwise spill into the next class's bit.
  */
-#define _PID_MAP(itf, n)  ( (CFG_TUD_##itf) << (n) )
+#define _PID_MAP(itf, n)  ( (CFG_TUD_##itf ? 1 : 0) << (n) )
 #define USB_PID           (0x4000 | _PID_MAP(CDC, 0) | _PID_MAP(MSC, 1) | _PID_MAP(HID, 2) | \
                            _PID_MAP(MIDI, 3) | _PID_MAP(VENDOR, 4) )
 
@@ -84,27 +88,62 @@ enum
   ITF_NUM_CDC = 0,
   ITF_NUM_CDC_DATA,
   ITF_NUM_HID,
-  ITF_NUM_TOTAL
+  ITF_NUM_MSC = ITF_NUM_HID + CFG_TUD_HID,
+  ITF_NUM_TOTAL = ITF_NUM_MSC + CFG_TUD_MSC
 };
 
 #define EPNUM_CDC_NOTIF   0x81
 #define EPNUM_CDC_OUT     0x02
 #define EPNUM_CDC_IN      0x82
 #define EPNUM_HID   0x83
+#define EPNUM_HID_MOUSE   0x84
+#define EPNUM_MSC_OUT     0x05
+#define EPNUM_MSC_IN      0x85
 
-#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + TUD_HID_DESC_LEN)
-#define CONFIG_NO_CDC_LEN    (TUD_CONFIG_DESC_LEN + TUD_HID_DESC_LEN)
+#define CONFIG_TOTAL_LEN    (TUD_CONFIG_DESC_LEN + TUD_CDC_DESC_LEN + CFG_TUD_HID * TUD_HID_DESC_LEN + \
+                             CFG_TUD_MSC * TUD_MSC_DESC_LEN)
+#define CONFIG_NO_CDC_LEN    (TUD_CONFIG_DESC_LEN + CFG_TUD_HID * TUD_HID_DESC_LEN)
 
 extern bool cdc_enabled;
 
+#if USB_HID_SPLIT_INTERFACES
+
+// boot keyboard, so it also works in a BIOS
+uint8_t const desc_hid_report[] =
+{
+  TUD_HID_REPORT_DESC_KEYBOARD()
+};
+
+uint8_t const desc_hid_report_mouse[] =
+{
+  TUD_HID_REPORT_DESC_MOUSE   ( HID_REPORT_ID(REPORT_ID_MOUSE)    ),
+  TUD_HID_REPORT_DESC_CONSUMER( HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL) ),
+  TUD_HID_REPORT_DESC_GAMEPAD ( HID_REPORT_ID(REPORT_ID_GAMEPAD)  )
+};
+
+// HID interfaces starting at _itf: Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
+#define HID_DESCRIPTORS(_itf) \
+  TUD_HID_DESCRIPTOR(_itf, 0, HID_ITF_PROTOCOL_KEYBOARD, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, USB_HID_POLL_INTERVAL_MS), \
+  TUD_HID_DESCRIPTOR(_itf + 1, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report_mouse), EPNUM_HID_MOUSE, CFG_TUD_HID_EP_BUFSIZE, USB_HID_POLL_INTERVAL_MS)
+
+#else
+
 uint8_t const desc_hid_report[] =
 {
   // Add keyboard report descriptor with its ID
   TUD_HID_REPORT_DESC_KEYBOARD( HID_REPORT_ID(REPORT_ID_KEYBOARD) ),
   // Add mouse report descriptor with its unique ID
-  TUD_HID_REPORT_DESC_MOUSE   ( HID_REPORT_ID(REPORT_ID_MOUSE)    )
+  TUD_HID_REPORT_DESC_MOUSE   ( HID_REPORT_ID(REPORT_ID_MOUSE)    ),
+  TUD_HID_REPORT_DESC_CONSUMER( HID_REPORT_ID(REPORT_ID_CONSUMER_CONTROL) ),
+  TUD_HID_REPORT_DESC_GAMEPAD ( HID_REPORT_ID(REPORT_ID_GAMEPAD)  )
 };
 
+// Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
+#define HID_DESCRIPTORS(_itf) \
+  TUD_HID_DESCRIPTOR(_itf, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, USB_HID_POLL_INTERVAL_MS)
+
+#endif
+
 
 // full speed configuration
 uint8_t const desc_fs_configuration[] =
@@ -115,18 +154,22 @@ uint8_t const desc_fs_configuration[] =
   // Interface number, string index, EP notification address and size, EP data address (out, in) and size.
   TUD_CDC_DESCRIPTOR(ITF_NUM_CDC, 4, EPNUM_CDC_NOTIF, 8, EPNUM_CDC_OUT, EPNUM_CDC_IN, 64),
 
-    // Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
-  TUD_HID_DESCRIPTOR(ITF_NUM_HID, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 5)
+  HID_DESCRIPTORS(ITF_NUM_HID),
+
+#if CFG_TUD_MSC
+  // Interface number, string index, EP Out & EP In address, EP size
+  TUD_MSC_DESCRIPTOR(ITF_NUM_MSC, 5, EPNUM_MSC_OUT, EPNUM_MSC_IN, 64),
+#endif
 };
 
 // no cdc configuration
 uint8_t const desc_config_without_cdc[] =
 {
   // Config number, interface count, string index, total length, attribute, power in mA
-  TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL - 2, 0, CONFIG_NO_CDC_LEN, 0x00, 100),
+  // (no MSC either, it is only there for retrieval)
+  TUD_CONFIG_DESCRIPTOR(1, ITF_NUM_TOTAL - 2 - CFG_TUD_MSC, 0, CONFIG_NO_CDC_LEN, 0x00, 100),
 
-  // Interface number, string index, protocol, report descriptor len, EP In address, size & polling interval
-  TUD_HID_DESCRIPTOR(ITF_NUM_HID - 2, 0, HID_ITF_PROTOCOL_NONE, sizeof(desc_hid_report), EPNUM_HID, CFG_TUD_HID_EP_BUFSIZE, 5)
+  HID_DESCRIPTORS(ITF_NUM_HID - 2)
 };
 
 // Invoked when received GET CONFIGURATION DESCRIPTOR
@@ -158,6 +201,7 @@ char const* string_desc_arr [] =
   "TinyUSB Device",              // 2: Product
   "123456789012",                // 3: Serials, should use chip ID
   "TinyUSB CDC",                 // 4: CDC Interface
+  "TinyUSB Log",                 // 5: MSC Interface
 };
 
 static uint16_t _desc_str[32];
@@ -211,7 +255,11 @@ uint16_t const* tud_descriptor_string_cb(uint8_t index, uint16_t langid)
 // Descriptor contents must exist long enough for transfer to complete
 uint8_t const * tud_hid_descriptor_report_cb(uint8_t itf)
 {
+#if USB_HID_SPLIT_INTERFACES
+  if (itf == HID_ITF_MOUSE) return desc_hid_report_mouse;
+#else
   (void) itf;
+#endif
   return desc_hid_report;
 }
 
@@ -246,9 +294,6 @@ uint16_t tud_hid_get_report_cb(uint8_t instance, uint8_t report_id, hid_report_t
 // Note: For composite reports, report[0] is report ID
 void tud_hid_report_complete_cb(uint8_t instance, uint8_t const* report, uint16_t len)
 {
-  (void) instance;
-  (void) len;
-
-
-  uint8_t next_report_id = report[0] + 1u;
+  // the host has the report now, close its pass-through latency sample and queue the next one
+  hid_forward_report_complete(instance, report, len);
 }
\ No newline at end of file
@@ -25,6 +25,15 @@
 #ifndef USB_DESCRIPTORS_H_
 #define USB_DESCRIPTORS_H_
 
+#include "tusb.h"
+
+// device HID instance each input class is sent on, the same one when not split
+enum
+{
+  HID_ITF_KEYBOARD = 0,
+  HID_ITF_MOUSE = CFG_TUD_HID - 1,
+};
+
 enum
 {
   REPORT_ID_KEYBOARD = 1,
@@ -34,4 +43,11 @@ enum
   REPORT_ID_COUNT
 };
 
+// the keyboard interface is a boot keyboard when split, and those carry no report ID
+#if USB_HID_SPLIT_INTERFACES
+#define HID_REPORT_ID_KEYBOARD 0
+#else
+#define HID_REPORT_ID_KEYBOARD REPORT_ID_KEYBOARD
+#endif
+
 #endif /* USB_DESCRIPTORS_H_ */
\ No newline at end of file